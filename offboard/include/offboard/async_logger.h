@@ -0,0 +1,175 @@
+#ifndef ASYNC_LOGGER_H_
+#define ASYNC_LOGGER_H_
+
+#include<array>
+#include<atomic>
+#include<chrono>
+#include<cstdint>
+#include<cstdio>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<type_traits>
+#include<vector>
+
+const int LOG_MAX_SOURCES = 32; // log sources (one per vehicle) with their own prefix and rate limits, source 0 has neither
+
+/* call site of a log statement: printf format and rate limit, one static instance per site */
+struct LogSite
+{
+	LogSite(const char *format, double min_interval);
+
+	const char *format; // printf format, numeric conversions only (%d, %ld, %zu, %u, %x, %f, %e, %g, ...)
+	int64_t min_interval_ns; // minimum time between two records of this site and source, 0 logs every call (ns)
+	std::array<std::atomic<int64_t>, LOG_MAX_SOURCES> next_ns; // earliest time of the next record of each source (ns)
+	std::atomic<uint64_t> limited; // records skipped by the rate limit
+};
+
+/* compact binary log record: site and raw arguments, formatted by the writer thread */
+struct LogRecord
+{
+	static const int MAX_ARGS = 8;
+
+	union Arg
+	{
+		long long i;
+		unsigned long long u;
+		double d;
+	};
+
+	const LogSite *site; // format of the record
+	int64_t stamp_ns; // steady clock time of the call (ns)
+	uint8_t source; // registered source (vehicle) of the record, its prefix is written before the text
+	uint8_t num_args; // used entries of args
+	std::array<char, MAX_ARGS> types; // 'i' signed, 'u' unsigned, 'd' floating point
+	std::array<Arg, MAX_ARGS> args;
+};
+
+/* single producer single consumer ring of one logging thread */
+class LogRing
+{
+  public:
+	static const size_t CAPACITY = 1024; // power of two
+
+	bool push(const LogRecord &record); // producer side, false when full
+	bool pop(LogRecord &record); // consumer side, false when empty
+	bool peek(int64_t &stamp_ns) const; // consumer side, stamp of the oldest record
+	uint64_t dropped() const { return dropped_; }
+
+  private:
+	std::array<LogRecord, CAPACITY> records_;
+	std::atomic<size_t> head_{0}; // next record to write (producer)
+	std::atomic<size_t> tail_{0}; // next record to read (consumer)
+	std::atomic<uint64_t> dropped_{0}; // records lost because the ring was full
+};
+
+/* asynchronous logger of the control loops
+   a log call stamps the record, packs its arguments and pushes it into the ring of the calling thread:
+   no lock, no formatting, no I/O. The writer thread merges the rings in time order, formats the records
+   and writes them to the console and, optionally, a file. Before start() (or after stop()) calls are
+   formatted and printed synchronously, like printf */
+class AsyncLogger
+{
+  public:
+	static AsyncLogger &instance();
+	~AsyncLogger();
+
+	void start(const std::string &file, bool console = true, double period = 0.005); // start the writer thread (period between two drains, s)
+	void stop(); // drain the rings and stop the writer thread
+	void registerThread(); // allocate the ring of the calling thread ahead of time, e.g. before a real-time loop
+	uint8_t registerSource(const std::string &name); // source id of one vehicle (e.g. its node namespace), the same name gets the same id, 0 when all are taken
+
+	template<typename... Args>
+	void log(LogSite &site, uint8_t source, Args... args); // log one record from site, arguments must be numeric
+
+	uint64_t dropped() const; // records lost because a ring was full
+	uint64_t limited() const { return limited_; } // records skipped by the rate limits
+	uint64_t written() const { return written_; } // records written by the writer thread
+
+  private:
+	AsyncLogger() = default;
+
+	mutable std::mutex rings_mutex_; // guards rings_, taken once per thread and once per drain
+	std::vector<std::unique_ptr<LogRing>> rings_; // one ring per logging thread, kept until the logger is destroyed
+	std::atomic<bool> running_{false};
+	std::thread thread_;
+	std::mutex output_mutex_; // serializes start/stop and synchronous writes
+	FILE *file_ = nullptr; // log file, nullptr when disabled
+	bool console_ = true; // write records to stdout
+	double period_ = 0.005;
+	std::atomic<uint64_t> limited_{0};
+	std::atomic<uint64_t> written_{0};
+	uint64_t reported_dropped_ = 0; // dropped count already reported by the writer thread
+	std::mutex sources_mutex_; // guards registerSource
+	std::array<std::string, LOG_MAX_SOURCES> sources_; // prefix of each source, never changed once registered
+	std::atomic<int> num_sources_{1}; // registered sources, source 0 is the unnamed one
+
+	LogRing *ring(); // ring of the calling thread
+	bool allow(LogSite &site, uint8_t source, int64_t now_ns); // rate limit of site for one source
+	void enqueue(const LogRecord &record);
+	void run(); // writer thread
+	size_t drain(); // write the pending records of all rings in time order
+	void write(const LogRecord &record);
+
+	static int64_t now();
+	static void pack(LogRecord &) {}
+	template<typename T, typename... Rest>
+	static void pack(LogRecord &record, T value, Rest... rest);
+};
+
+/* format a record into buffer, returns the formatted length (snprintf semantics) */
+int formatLogRecord(const LogRecord &record, char *buffer, size_t size);
+
+template<typename T, typename... Rest>
+void AsyncLogger::pack(LogRecord &record, T value, Rest... rest) {
+	static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "async log arguments must be numeric");
+	const int k = record.num_args++;
+	if (std::is_floating_point<T>::value) {
+		record.types[k] = 'd';
+		record.args[k].d = static_cast<double>(value);
+	}
+	else if (std::is_signed<T>::value) {
+		record.types[k] = 'i';
+		record.args[k].i = static_cast<long long>(value);
+	}
+	else {
+		record.types[k] = 'u';
+		record.args[k].u = static_cast<unsigned long long>(value);
+	}
+	pack(record, rest...);
+}
+
+template<typename... Args>
+void AsyncLogger::log(LogSite &site, uint8_t source, Args... args) {
+	static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "too many async log arguments");
+	const int64_t stamp = now();
+	if (!allow(site, source, stamp)) {
+		return;
+	}
+	LogRecord record;
+	record.site = &site;
+	record.stamp_ns = stamp;
+	record.source = source;
+	record.num_args = 0;
+	pack(record, args...);
+	enqueue(record);
+}
+
+/* log source of the code outside a vehicle: unnamed. Inside OffboardControl the unqualified call in
+   the macros finds its logSource() member instead, so each vehicle has its prefix and rate limits */
+inline uint8_t logSource() {
+	return 0;
+}
+
+/* printf replacement for the control loops, one static LogSite per statement */
+#define OFFBOARD_LOG(...) OFFBOARD_LOG_THROTTLE(0.0, __VA_ARGS__)
+
+/* at most one record every period seconds from this statement and log source, the others are counted as limited */
+#define OFFBOARD_LOG_THROTTLE(period, format, ...) \
+	do { \
+		static LogSite offboard_log_site_(format, period); \
+		AsyncLogger::instance().log(offboard_log_site_, logSource(), ##__VA_ARGS__); \
+	} while (0)
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef CONTROL_LAW_H_
+#define CONTROL_LAW_H_
+
+#include<eigen3/Eigen/Dense>
+
+/* setpoint laws of the ENU flight loops, free of ROS so the offline mission evaluator flies the same code */
+
+const double APPROACH_DISTANCE = 3.0; // below this distance to the setpoint a leg is flown at APPROACH_VELOCITY (m)
+const double APPROACH_VELOCITY = 0.3; // speed of the final approach of a setpoint (m/s)
+const double ROTATE_THRESHOLD = 0.2; // heading error above which the drone rotates in place before moving (rad)
+
+Eigen::Vector3d velocityTowards(double v_desired, const Eigen::Vector3d &current, const Eigen::Vector3d &target); // velocity of magnitude v_desired pointing to target
+double legVelocity(double distance, double v_desired); // speed of a leg at a distance from its setpoint
+double bearingTo(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint); // heading from current to setpoint in the x, y plane (rad, -pi..pi)
+double unwrapYaw(double yaw, double target); // target shifted by 2 pi so the turn from yaw is the short one
+double yawStep(double yaw, double target, double yaw_rate); // yaw command of one tick: target, at most yaw_rate away from yaw
+
+#endif
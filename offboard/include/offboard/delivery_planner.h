@@ -0,0 +1,56 @@
+#ifndef DELIVERY_PLANNER_H_
+#define DELIVERY_PLANNER_H_
+
+#include<eigen3/Eigen/Dense>
+#include<eigen3/Eigen/StdVector>
+
+#include<chrono>
+#include<utility>
+#include<vector>
+
+/* pending setpoint of the mission in flight */
+struct DeliveryStop
+{
+	int id; // delivery id, stable while the order changes
+	Eigen::Vector3d position; // ENU setpoint (m)
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<DeliveryStop, Eigen::aligned_allocator<DeliveryStop>> DeliveryRoute;
+
+/* online re-planning of the remaining visit order
+   the route starts at the current vehicle position and its last stop (landing or return point) is fixed,
+   so are its first_fixed stops (the one being delivered while the vehicle is at it).
+   A k-d tree over the pending stops limits cheapest insertion to the edges around the nearest stops,
+   then 2-opt moves shorten the route; the whole update stops after budget_ms, keeping the best route found */
+class DeliveryPlanner
+{
+  public:
+	DeliveryPlanner(double budget_ms = 2.0, int candidates = 8);
+
+	void rebuild(const DeliveryRoute &route); // re-index the pending stops after the route changed
+	int insert(const Eigen::Vector3d &start, DeliveryRoute &route, const DeliveryStop &stop, int first_fixed = 0); // insert before the last stop and after the first_fixed ones and improve, returns the new index of stop
+	bool cancel(DeliveryRoute &route, int id, int first_fixed = 0); // remove a stop (not the last one nor the first_fixed ones)
+	void etas(const Eigen::Vector3d &start, const DeliveryRoute &route, double velocity, double service_time, std::vector<double> &eta) const; // time until each stop is reached (s)
+
+  private:
+	struct Node // k-d tree node over stop indexes
+	{
+		int index; // stop of this node
+		int axis; // split axis
+		int left = -1, right = -1; // children nodes
+	};
+
+	double budget_ms_; // time budget of one update (ms)
+	int candidates_; // nearest stops whose edges are tried for insertion
+	std::vector<Eigen::Vector3d> points_; // positions indexed by the tree
+	std::vector<Node> nodes_; // k-d tree
+	int root_ = -1;
+
+	int build(std::vector<int> &indexes, int begin, int end, int depth); // build a balanced subtree
+	void nearest(int node, const Eigen::Vector3d &query, int k, std::vector<std::pair<double, int>> &best) const; // k nearest stop indexes
+	bool twoOpt(const Eigen::Vector3d &start, DeliveryRoute &route, int first, std::chrono::steady_clock::time_point deadline) const; // improve from stop first on, false when the budget ran out
+};
+
+#endif
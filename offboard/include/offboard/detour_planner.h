@@ -0,0 +1,52 @@
+#ifndef DETOUR_PLANNER_H_
+#define DETOUR_PLANNER_H_
+
+#include"offboard/spatial_map.h"
+
+#include<eigen3/Eigen/Dense>
+
+#include<condition_variable>
+#include<cstdint>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+/* runs SpatialMap::planDetour on its own thread
+   A* on a large map takes up to seconds (its whole node budget when the goal is unreachable), the control
+   loop posts the blocked leg, keeps publishing its hold position and picks the detour up on a later tick.
+   Only the newest request is planned, results of replaced requests are dropped. The mutex is held for
+   copies only, so the control thread never waits for a search */
+class DetourPlanner
+{
+  public:
+	explicit DetourPlanner(const SpatialMap &map); // map must outlive the planner and not change while it runs
+	~DetourPlanner();
+
+	void start(); // start the planner thread
+	void stop(); // stop and join the planner thread, a search in progress is finished first
+
+	void request(const Eigen::Vector3d &start, const Eigen::Vector3d &goal); // plan a detour, replaces any earlier request
+	bool result(std::vector<Eigen::Vector3d> &waypoints, bool &found, double &planning_ms); // true once, when the newest request is planned (waypoints end with goal)
+
+  private:
+	const SpatialMap &map_;
+
+	std::mutex mutex_; // guards everything below
+	std::condition_variable wake_; // a request was posted or the planner stops
+	Eigen::Vector3d start_ = Eigen::Vector3d::Zero(); // leg of the newest request
+	Eigen::Vector3d goal_ = Eigen::Vector3d::Zero();
+	uint64_t requested_ = 0; // id of the newest request
+	uint64_t started_ = 0; // id of the request taken by the planner thread
+	uint64_t planned_ = 0; // id of the request of waypoints_
+	uint64_t taken_ = 0; // id of the result returned by result()
+	bool found_ = false; // a detour was found for planned_
+	double planning_ms_ = 0.0; // search time of planned_ (ms)
+	std::vector<Eigen::Vector3d> waypoints_; // detour of planned_
+
+	std::thread thread_;
+	bool running_ = false;
+
+	void run(); // planner thread: leave the real-time policy of the control thread, plan the newest request
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef DRIFT_ESTIMATOR_H_
+#define DRIFT_ESTIMATOR_H_
+
+#include<ros/ros.h>
+#include<ros/callback_queue.h>
+
+#include<nav_msgs/Odometry.h>
+#include<sensor_msgs/NavSatFix.h>
+
+#include<eigen3/Eigen/Dense>
+
+#include<array>
+#include<atomic>
+#include<thread>
+
+/* lock-free snapshot of a 3D vector: one writer thread, any number of readers (seqlock)
+   readers never block the writer, they retry the copy when it was torn by a store */
+class Vector3Snapshot
+{
+  public:
+	void store(const Eigen::Vector3d &value); // writer only
+	Eigen::Vector3d load() const;
+
+  private:
+	std::atomic<unsigned> sequence_{0}; // odd while a store is in progress
+	std::array<std::atomic<double>, 3> data_{};
+};
+
+/* continuous estimate of the offset between the odometry frame and the GPS converted ENU frame
+   (offset = odometry - GPS ENU, the quantity waitForStable averages once before takeoff).
+   Odometry and GPS are received on a private callback queue serviced by a dedicated thread; every GPS fix
+   is converted to ENU with the cached reference, compared to the odometry interpolated at the fix time
+   and fused by a Kalman filter with a random-walk offset model. Fixes failing the chi-square gate are
+   rejected, a long run of rejections (e.g. odometry reset) re-initializes the filter on the measurement.
+   The control loop reads the offset through a lock-free snapshot */
+class DriftEstimator
+{
+  public:
+	DriftEstimator(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private);
+	~DriftEstimator();
+
+	void start(const sensor_msgs::NavSatFix &ref, const Eigen::Vector3d &offset); // cache the ENU reference, start from the measured offset
+	void stop(); // stop and join the estimator thread
+	bool enabled() const { return enable_; }
+
+	Eigen::Vector3d offset() const { return offset_.load(); } // current offset odometry - GPS ENU (m)
+	Eigen::Vector3d drift() const { return drift_.load(); } // change of the offset since start, clamped to drift_max horizontally and drift_max_vertical vertically (m)
+	long updates() const { return updates_; } // fused GPS fixes
+	long rejected() const { return rejected_; } // GPS fixes rejected by the gate
+
+  private:
+	struct OdomSample
+	{
+		double stamp; // header time (s)
+		Eigen::Vector3d position; // odometry position (m)
+	};
+
+	static const int ODOM_HISTORY = 64; // odometry samples kept to match delayed GPS fixes
+
+	ros::NodeHandle nh_;
+	ros::NodeHandle nh_private_;
+	ros::CallbackQueue callback_queue_; // estimator callbacks only, serviced by thread_
+	ros::Subscriber odom_sub_; // odometry subscriber
+	ros::Subscriber gps_sub_; // GPS subscriber
+
+	bool enable_; // drift_enable parameter
+	double process_noise_; // random walk of the offset (m/sqrt(s))
+	double gps_sigma_h_, gps_sigma_v_; // GPS standard deviation when the fix has no covariance (m)
+	double initial_sigma_; // standard deviation of the offset measured before takeoff (m)
+	double gate_; // chi-square gate of the innovation (3 dof)
+	int max_rejected_; // consecutive rejected fixes before the filter is re-initialized
+	double drift_max_; // bound of the applied horizontal drift (m)
+	double drift_max_vertical_; // bound of the applied vertical drift, GPS altitude is too noisy to move the altitude setpoints further (m)
+
+	Eigen::Vector3d ref_ecef_; // cached ECEF of the reference
+	Eigen::Matrix3d ecef_to_enu_; // cached rotation ECEF -> ENU at the reference
+	Eigen::Vector3d initial_offset_; // offset given to start()
+	Eigen::Vector3d state_; // filter state: offset (m)
+	Eigen::Matrix3d covariance_; // filter covariance (m^2)
+	double last_update_ = 0.0; // time of the last fused fix (s)
+	int rejected_in_row_ = 0;
+	std::array<OdomSample, ODOM_HISTORY> odom_history_; // ring of odometry samples
+	int odom_count_ = 0; // samples stored in odom_history_ (up to ODOM_HISTORY)
+	int odom_next_ = 0; // next slot of odom_history_
+
+	Vector3Snapshot offset_; // published state_
+	Vector3Snapshot drift_; // published state_ - initial_offset_
+	std::atomic<long> updates_{0};
+	std::atomic<long> rejected_{0};
+
+	std::thread thread_;
+	std::atomic<bool> running_{false};
+
+	void run(); // estimator thread: leave the real-time policy of the control thread, service the callbacks
+	Eigen::Vector3d toENU(const sensor_msgs::NavSatFix &fix) const; // WGS84 -> ENU with the cached reference
+	bool odomAt(double stamp, Eigen::Vector3d &position) const; // odometry interpolated at stamp
+	void publish();
+	void odomCallback(const nav_msgs::Odometry::ConstPtr &msg);
+	void gpsCallback(const sensor_msgs::NavSatFix::ConstPtr &msg);
+};
+
+#endif
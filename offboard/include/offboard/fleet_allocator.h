@@ -0,0 +1,66 @@
+#ifndef FLEET_ALLOCATOR_H_
+#define FLEET_ALLOCATOR_H_
+
+#include<eigen3/Eigen/Dense>
+
+#include<vector>
+
+/* vehicle taking part in the allocation */
+struct FleetVehicle
+{
+	Eigen::Vector3d home; // home position in the shared ENU frame (m)
+	double max_range; // maximum route length including the way back home (m), <= 0 for unlimited
+	double max_payload; // maximum total payload carried in one sortie (kg), <= 0 for unlimited
+};
+
+/* delivery point to be served by exactly one vehicle */
+struct FleetDelivery
+{
+	Eigen::Vector3d position; // drop position in the shared ENU frame (m)
+	double payload; // payload dropped at this point (kg)
+};
+
+/* result of the allocation */
+struct FleetAssignment
+{
+	std::vector<std::vector<int>> routes; // ordered delivery indexes of each vehicle
+	std::vector<double> route_time; // time to fly each route, home to home (s)
+	std::vector<int> unassigned; // deliveries no vehicle can serve within its limits
+	double makespan = 0.0; // time until the last vehicle is back home (s)
+};
+
+/* multi-vehicle delivery allocator minimizing the mission makespan:
+   farthest-first cheapest insertion builds the routes, then relocate, swap and 2-opt moves
+   are searched in parallel until the longest route cannot be shortened any more */
+class FleetAllocator
+{
+  public:
+	FleetAllocator(double velocity, double service_time, int num_threads);
+
+	FleetAssignment solve(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries) const;
+
+  private:
+	struct Move // candidate local search move
+	{
+		int type = 0; // 0: none, 1: relocate, 2: swap
+		int from_route = -1, from_pos = -1, to_route = -1, to_pos = -1;
+		double makespan = 0.0, total = 0.0; // objective after the move
+	};
+
+	double velocity_; // cruise velocity (m/s)
+	double service_time_; // time spent at each drop: descent, unpack and climb (s)
+	int num_threads_; // worker threads used by the local search
+	int max_iterations_ = 1000; // upper bound of improving moves applied
+
+	double routeLength(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const; // home to home route length
+	double routeTime(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const; // home to home route time
+	bool feasible(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const; // check range and payload limits
+	bool better(double makespan, double total, double best_makespan, double best_total) const; // lexicographic objective: makespan first, then total time
+
+	void insertDeliveries(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, FleetAssignment &assignment) const; // initial routes
+	void improveRoutes(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, FleetAssignment &assignment) const; // parallel local search
+	void twoOpt(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, std::vector<int> &route) const; // reorder a single route
+	Move bestMoveTo(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, const FleetAssignment &assignment, int to_route) const; // best relocate/swap into one route
+};
+
+#endif
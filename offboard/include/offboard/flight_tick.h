@@ -0,0 +1,69 @@
+#ifndef FLIGHT_TICK_H_
+#define FLIGHT_TICK_H_
+
+#include"offboard/spatial_map.h"
+#include"offboard/detour_planner.h"
+
+#include<eigen3/Eigen/Dense>
+
+#include<cstdint>
+#include<vector>
+
+/* map validation of the legs flown by the OFFBOARD loops
+   the straight leg to a setpoint is checked once, a blocked one is planned by the detour planner thread
+   while the loop holds position, then flown through its detour waypoints. Every commanded step is checked
+   too, a blocked step holds position and forces a replan. Free of ROS node handles, so the per-tick work
+   is tested without a ROS master */
+class LegGuard
+{
+  public:
+	explicit LegGuard(const SpatialMap &map); // map must outlive the guard and not change while the planner runs
+
+	void configure(bool enable, double detour_error, uint8_t log_source, double log_period); // enable: map loaded, detour_error: waypoint reached (m)
+	void start() { planner_.start(); } // start the detour planner thread
+	void stop() { planner_.stop(); }
+	void reserve(size_t waypoints) { detour_.reserve(waypoints); } // detour waypoints kept without allocation
+
+	void reset(const Eigen::Vector3d &current); // a flight loop starts or the route changed, the next leg is validated again
+	Eigen::Vector3d waypoint(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint); // validate the leg when the setpoint moved, next detour waypoint or the setpoint
+	bool stepFree(const Eigen::Vector3d &current, const Eigen::Vector3d &carrot); // check the commanded step of this tick, a blocked one forces a replan
+	Eigen::Vector3d checkedCarrot(const Eigen::Vector3d &current, const Eigen::Vector3d &carrot); // carrot, or the hold position when its step is blocked
+	bool clear() const { return detour_.empty() && !blocked_; } // no detour waypoint left and the leg is not blocked, the setpoint itself can be reached
+
+  private:
+	const SpatialMap &map_;
+	DetourPlanner planner_; // A* detours of blocked legs, planned on its own thread
+	bool enable_ = false; // validate legs against map_
+	double detour_error_ = 0.5; // the offset to check when the drone reached a detour waypoint (m)
+	uint8_t log_source_ = 0; // AsyncLogger source of the vehicle
+	double log_period_ = 0.5; // minimum time between two "Blocked" messages (s)
+
+	std::vector<Eigen::Vector3d> detour_; // waypoints flown before the setpoint when its straight leg is blocked
+	bool valid_ = false; // setpoint_ was validated against the map
+	bool blocked_ = false; // no safe path to setpoint_ (yet), the loop holds position
+	bool planning_ = false; // the detour of setpoint_ is being planned
+	int replan_ticks_ = 0; // ticks since no detour was found for the blocked leg
+	Eigen::Vector3d setpoint_ = Eigen::Vector3d::Zero(); // setpoint of the validated leg
+	Eigen::Vector3d hold_ = Eigen::Vector3d::Zero(); // last position with a free step, held while the step is blocked
+
+	bool plan(const Eigen::Vector3d &start, const Eigen::Vector3d &setpoint); // validate a leg, a blocked one is handed to planner_
+	void takeDetour(); // pick up the detour of the blocked leg once planner_ finished it
+	uint8_t logSource() const { return log_source_; } // used by OFFBOARD_LOG
+};
+
+/* setpoint of one tick of the ENU flight loop */
+struct EnuTick
+{
+	Eigen::Vector3d position; // position to publish: the carrot, or the hold position while rotating or blocked
+	double yaw; // yaw to publish, at most yaw_rate away from the current yaw (rad)
+	double distance; // distance to the active waypoint (detour waypoint or setpoint) (m)
+	bool blocked; // the step of this tick is blocked in the map
+	bool rotating; // heading error above ROTATE_THRESHOLD, the drone rotates in place
+};
+
+/* per-tick work of the ENU flight loop: leg validation, carrot at the leg velocity, yaw step and hold position
+   input: leg guard, current position and yaw, drift corrected setpoint, desired velocity (m/s) and yaw rate (rad),
+   hold: position held while rotating or blocked, moved to current while flying */
+EnuTick enuTick(LegGuard &leg, const Eigen::Vector3d &current, double yaw, const Eigen::Vector3d &setpoint, double v_desired, double yaw_rate, Eigen::Vector3d &hold);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef MISSION_CHECKPOINT_H_
+#define MISSION_CHECKPOINT_H_
+
+#include<condition_variable>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+
+/* mission progress needed to continue a mission after the node restarted */
+struct MissionCheckpoint
+{
+	int next_target = 0; // index of the next unvisited setpoint
+	int deliveries_completed = 0; // number of packages already dropped
+	bool returning_home = false; // every setpoint is done (next_target is the final one), the mission goes on with return home
+	double home_x = 0.0, home_y = 0.0, home_z = 0.0; // home ENU position (m)
+	double home_qx = 0.0, home_qy = 0.0, home_qz = 0.0, home_qw = 0.0; // home orientation
+	double home_latitude = 0.0, home_longitude = 0.0, home_altitude = 0.0; // home GPS position
+	double ref_latitude = 0.0, ref_longitude = 0.0, ref_altitude = 0.0; // reference GPS of the ENU conversion
+	double x_offset = 0.0, y_offset = 0.0, z_offset = 0.0; // offset between odometry and GPS converted ENU (m)
+	std::vector<double> x_target, y_target, z_target; // ENU setpoints of the mission
+
+	void setTargets(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int n); // copy the first n setpoints in place, no allocation within the reserved capacity
+};
+
+/* checkpoint file on local storage
+   save() writes a temporary file, syncs it and renames it over the previous checkpoint,
+   so a crash or power loss leaves either the old or the new checkpoint, never a partial one */
+class MissionCheckpointFile
+{
+  public:
+	explicit MissionCheckpointFile(const std::string &path = "");
+
+	bool enabled() const { return !path_.empty(); }
+	bool save(const MissionCheckpoint &checkpoint) const; // atomically replace the checkpoint
+	bool load(MissionCheckpoint &checkpoint) const; // read the checkpoint, false if missing or invalid
+	void clear() const; // remove the checkpoint when the mission is finished
+
+  private:
+	std::string path_; // checkpoint file, empty when checkpointing is disabled
+};
+
+/* writes the checkpoints of the flight loops on its own thread
+   save() syncs the file and its directory, tens of ms on flash storage: post() only copies the checkpoint
+   (no allocation within the reserved setpoints) and the writer thread saves the newest one, a checkpoint
+   replaced before it was written is skipped */
+class CheckpointWriter
+{
+  public:
+	~CheckpointWriter();
+
+	void start(const MissionCheckpointFile &file); // start the writer thread
+	void stop(); // write the pending checkpoint and join the writer thread
+	void reserve(size_t targets); // reserve the setpoint lists of the posted checkpoints
+	void post(const MissionCheckpoint &checkpoint); // queue the checkpoint, saved at once when the thread is not running
+	void flush(); // wait until the posted checkpoints are saved, e.g. before the file is cleared
+
+  private:
+	MissionCheckpointFile file_;
+	std::mutex mutex_; // guards everything below
+	std::condition_variable wake_; // a checkpoint was posted or the writer stops
+	std::condition_variable idle_; // nothing posted and nothing being saved
+	MissionCheckpoint pending_; // newest posted checkpoint
+	MissionCheckpoint writing_; // checkpoint being saved by the writer thread
+	bool posted_ = false; // pending_ is not saved yet
+	bool busy_ = false; // the writer thread is saving writing_
+	std::thread thread_;
+	bool running_ = false;
+
+	void run(); // writer thread: leave the real-time policy of the control thread, save the posted checkpoints
+};
+
+#endif
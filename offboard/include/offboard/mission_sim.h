@@ -0,0 +1,100 @@
+#ifndef MISSION_SIM_H_
+#define MISSION_SIM_H_
+
+#include"offboard/touchdown_detector.h"
+
+#include<eigen3/Eigen/Dense>
+#include<eigen3/Eigen/StdVector>
+
+#include<random>
+#include<vector>
+
+/* offboard.launch parameters explored by the tuner, defaults are the launch values */
+struct TuningParams
+{
+	double yaw_rate = 0.05; // yaw command step per control tick (rad)
+	double target_error = 0.1; // radius to consider a setpoint reached (m)
+	double desired_velocity = 0.7; // speed of the legs (m/s)
+	double land_error = 0.1; // radius to consider the landing point reached (m)
+	double z_takeoff = 5.0; // takeoff altitude (m)
+};
+
+/* vehicle model and mission settings kept fixed while tuning (launch and PX4 defaults) */
+struct SimConfig
+{
+	double dt = 0.02; // integration step, also the odometry period (s)
+	double control_rate = 10.0; // rate of the takeoff, hover and ENU flight loops (Hz)
+	double land_rate = 20.0; // rate of the landing loop (Hz)
+	double takeoff_hover_time = 5.0; // hover after takeoff (s)
+	double hover_time = 5.0; // hover over the final setpoint before landing (s)
+	DescentProfile descent; // land_velocity, touchdown_velocity, slow_descent_height, descent_blend_height
+	double touchdown_window = 0.1; // touchdown detector thresholds, see TouchdownDetector
+	double touchdown_max_speed = 0.1;
+	double touchdown_max_spread = 0.03;
+	double touchdown_max_height = 0.3;
+
+	double xy_p = 0.95; // FCU position gain, horizontal (1/s)
+	double z_p = 1.0; // FCU position gain, vertical (1/s)
+	double max_velocity_xy = 12.0; // FCU horizontal speed limit (m/s)
+	double max_velocity_up = 3.0; // FCU climb rate limit (m/s)
+	double max_velocity_down = 1.0; // FCU descent rate limit (m/s)
+	double velocity_tau = 0.25; // time constant of the FCU velocity loop (s)
+	double yaw_p = 2.8; // FCU yaw gain (1/s)
+	double max_yaw_rate = 0.785; // FCU yaw rate limit in auto modes (rad/s)
+	double auto_land_velocity = 0.7; // descent speed of AUTO.LAND (m/s)
+	double gust_tau = 2.0; // correlation time of the gusts (s)
+	double timeout = 900.0; // a mission not landed after this time failed (s)
+
+	SimConfig() { descent.fast_velocity = 1.0; }
+};
+
+typedef std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> SimTargets;
+
+/* one randomized mission: ENU setpoints and the disturbances injected */
+struct SimScenario
+{
+	SimTargets targets; // setpoints in the GPS ENU frame, the last one is landed under (m)
+	double initial_yaw = 0.0; // heading on the ground (rad)
+	double gust_sigma = 0.0; // standard deviation of the gust velocity left by the FCU wind rejection (m/s)
+	Eigen::Vector3d gps_offset = Eigen::Vector3d::Zero(); // error of the odometry/GPS offset measured before takeoff (m)
+	double drift_rate = 0.0; // random walk of the odometry (m/sqrt(s))
+	double odom_noise = 0.0; // standard deviation of the odometry position (m)
+	double yaw_noise = 0.0; // standard deviation of the odometry heading (rad)
+	double latency = 0.0; // age of the odometry seen by the node (s)
+	unsigned seed = 0; // seed of the disturbances
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/* bounds of the randomized scenarios */
+struct ScenarioRanges
+{
+	int max_targets = 4; // setpoints per mission (1..max_targets)
+	double radius = 40.0; // setpoints within this horizontal distance of the start (m)
+	double min_altitude = 3.0, max_altitude = 8.0; // altitude of the setpoints (m)
+	double wind_max = 8.0; // mean wind speed, uniform in 0..wind_max (m/s)
+	double gust_ratio = 0.1; // gust standard deviation / mean wind speed
+	double gps_sigma = 0.5; // standard deviation of the horizontal offset error (m), a third of it vertically
+	double drift_max = 0.02; // odometry random walk, uniform in 0..drift_max (m/sqrt(s))
+	double odom_noise_max = 0.05; // odometry noise, uniform in 0..odom_noise_max (m)
+	double yaw_noise = 0.01; // odometry heading noise (rad)
+	double latency_max = 0.15; // odometry age, uniform in 0..latency_max (s)
+};
+
+struct SimResult
+{
+	bool success = false; // landed before the timeout
+	double mission_time = 0.0; // takeoff command to touchdown (s)
+	double landing_error = 0.0; // horizontal distance between touchdown and the last setpoint (m)
+};
+
+void generateScenario(const ScenarioRanges &ranges, std::mt19937 &rng, SimScenario &scenario); // draw a random mission
+
+/* fly one mission with the control laws of the ENU flight (takeoff, hover, legs with rate limited yaw,
+   hover, landing with the descent profile and touchdown detector, AUTO.LAND) on a kinematic vehicle:
+   the FCU tracks the setpoints with a P position loop in its own estimate and a first order velocity loop,
+   the estimate is the true position plus the odometry drift and noise, the node sees it late by the latency
+   and converts the setpoints with the wrong GPS offset, gusts push the vehicle. Deterministic for a scenario */
+SimResult simulateMission(const TuningParams &params, const SimScenario &scenario, const SimConfig &config);
+
+#endif
@@ -2,6 +2,7 @@
 #define OFFBOARD_H_
 
 #include<ros/ros.h>
+#include<ros/callback_queue.h>
 #include<tf/tf.h>
 #include<tf/transform_datatypes.h>
 
@@ -15,14 +16,23 @@
 #include<geometry_msgs/TwistStamped.h>
 #include<geographic_msgs/GeoPoseStamped.h>
 #include<sensor_msgs/NavSatFix.h>
+#include<sensor_msgs/Range.h>
+#include<mavros_msgs/AttitudeTarget.h>
+#include<mavros_msgs/CommandCode.h>
+#include<mavros_msgs/Waypoint.h>
+#include<mavros_msgs/WaypointPush.h>
+#include<mavros_msgs/WaypointClear.h>
+#include<mavros_msgs/WaypointReached.h>
 
 #include<eigen3/Eigen/Dense>
 // #include <unsupported/Eigen/FFT>
 
+#include<algorithm>
 #include<iostream>
 #include<cmath>
 #include<cstdio>
 #include<vector>
+#include<atomic>
 
 //#include<offboard/traj_gen.h>
 #include<std_msgs/Float32MultiArray.h>
@@ -30,12 +40,37 @@
 #include<nav_msgs/Odometry.h>
 #include<eigen_conversions/eigen_msg.h>
 
+#include"offboard/spatial_map.h"
+#include"offboard/flight_tick.h"
+#include"offboard/mission_checkpoint.h"
+#include"offboard/touchdown_detector.h"
+#include"offboard/topic_watchdog.h"
+#include"offboard/drift_estimator.h"
+#include"offboard/realtime.h"
+#include"offboard/async_logger.h"
+#include"offboard/search_pattern.h"
+#include"offboard/delivery_planner.h"
+#include"offboard/control_law.h"
+#include<offboard/AddDelivery.h>
+#include<offboard/CancelDelivery.h>
+#include<offboard/DeliveryEtas.h>
+
+/* messages of the flight loops are filled in place: within the reserved capacity they do not allocate */
+void fillTargetPose(geometry_msgs::PoseStamped &pose, const Eigen::Vector3d &position, const geometry_msgs::Quaternion &orientation, const ros::Time &stamp); // setpoint of one control tick
+void fillDeliveryEtas(offboard::DeliveryEtas &msg, const DeliveryRoute &route, const std::vector<double> &eta, const ros::Time &stamp); // pending setpoints and their ETA
+void fillRoute(DeliveryRoute &route, const std::vector<int> &ids, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int first, int last); // setpoints first..last-1 as a route
+
 class OffboardControl
 {
   public:
 	// OffboardControl();
-	OffboardControl(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private, bool input_setpoint);
+	OffboardControl(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private, bool input_setpoint); // input_setpoint: run the mission inside the constructor and shut the node down when it ends
 	~OffboardControl();
+
+	void runMission(); // wait for FCU, take input and fly the mission (blocking)
+	void requestStop(); // make the mission loops return as soon as possible
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   private:
 	/* CONSTANT */
 	const double PI = 3.141592653589793238463; // PI
@@ -50,6 +85,7 @@ class OffboardControl
 
 	ros::NodeHandle nh_;
 	ros::NodeHandle nh_private_;
+	ros::CallbackQueue callback_queue_; // callbacks of this vehicle only, serviced from the mission loops
 
 	ros::Subscriber state_sub_; // current state subscriber
 	ros::Subscriber gps_position_sub_; // current gps position subscriber
@@ -57,6 +93,8 @@ class OffboardControl
 	ros::Subscriber odom_sub_; // odometry subscriber
 	ros::Subscriber point_target_sub_;// target point from planner subscriber
 	ros::Subscriber check_last_opt_sub_;// check last optimization point from planner subscriber
+	ros::Subscriber rangefinder_sub_; // downward rangefinder subscriber (optional)
+	ros::Subscriber thrust_sub_; // thrust target of the FCU subscriber
 	
 	//DuyNguyen
 	ros::Subscriber marker_p_sub_;
@@ -80,7 +118,8 @@ class OffboardControl
 	//DuyNguyen
 	geometry_msgs::PoseStamped marker_position_; // call back the marker position 
 	bool check_mov_; // check move to the centre of UAV
-	bool check_ids_; // check have the ids or not ?
+	bool check_ids_ = false; // check have the ids or not ?
+	ros::Time marker_stamp_; // receipt time of marker_position_
 	geometry_msgs::PoseStamped current_position_; // call back the current position
 	double current_z_; // current z position
 	mavros_msgs::SetMode offboard_setmode_; //check mode flight of uav
@@ -100,6 +139,11 @@ class OffboardControl
 	bool delivery_mode_enable_; // check enabled delivery mode or not
 	bool simulation_mode_enable_; // check enabled simulation mode or not
 	bool return_home_mode_enable_; // check enabled return home mode or not
+	bool interactive_input_; // ask mode and setpoints from keyboard or load them from parameters
+	std::atomic<bool> stop_requested_; // set when the mission finished or the owner wants the loops to return
+	bool shutdown_on_finish_; // shutdown ROS when the mission finished (standalone node only)
+	TopicWatchdog watchdog_; // odometry/GPS staleness failsafe, runs in its own thread
+	DriftEstimator drift_estimator_; // odometry/GPS offset tracked during the flight, runs in its own thread
 	
 	int num_of_enu_target_; // number of ENU (x,y,z) setpoints
 	std::vector<double> x_target_; // array of ENU x position of all setpoints
@@ -119,18 +163,125 @@ class OffboardControl
 	double distance_; // distance from current position to next setpoint
 	
 	double x_off_[100], y_off_[100], z_off_[100]; // array to calculate offset from current ENU (x,y,z) and GPS converted (x,y,z) in a period
-	double x_offset_, y_offset_, z_offset_; // average offset of current ENU (x,y,z) and GPS converted (x,y,z)
+	double x_offset_, y_offset_, z_offset_; // average offset of current ENU (x,y,z) and GPS converted (x,y,z), initial value of drift_estimator_
 	double z_takeoff_; // the height to takeoff when start. drone'll takeoff to z_takeoff_ then start the mission
 	double z_delivery_; // the height (set to 0.0 for land to ground - need to set disable auto-disarm of pixhawk) want drone go to for delivery in delivery mode
 
 	double vel_desired_, land_vel_, return_vel_; // corresponding desired speed to fly, when land and when return home
-	geometry_msgs::Vector3 components_vel_; // components of desired velocity about x, y, z axis
+	Eigen::Vector3d components_vel_; // components of desired velocity about x, y, z axis
 	double hover_time_, takeoff_hover_time_, unpack_time_; // corresponding hover time when reached setpoint, when takeoff and when unpacking
 	ros::Time operation_time_1_, operation_time_2_; // checkpoint to calculate operation time of each perform program
 
+	double yaw_ = 0.0; // current yaw angle from odometry
+	Eigen::Affine3d current_pose_ = Eigen::Affine3d::Identity(); // current pose from odometry
+	Eigen::Vector3d current_velocity_ = Eigen::Vector3d::Zero(); // current linear velocity from odometry
+
+	inline bool running() // mission loops keep going while ROS is up, no stop was requested and the watchdog did not trip
+	{
+		return ros::ok() && !stop_requested_ && !watchdog_.tripped();
+	}
+
+	inline void spinOnce() // service the callbacks of this vehicle
+	{
+		callback_queue_.callAvailable(ros::WallDuration());
+	}
+
+	void finishMission(bool landed); // stop the mission loops at the end of the mission, the checkpoint is removed only once landed
+	void loadTargetParams(); // load setpoints and mission modes from parameters
+
+	SpatialMap spatial_map_; // obstacle and geofence map loaded from map_file
+	LegGuard leg_guard_; // legs and steps of the flight loops checked against spatial_map_, detours planned on its own thread
+	bool map_enable_ = false; // validate mission legs and setpoints against spatial_map_
+	double detour_error_; // the offset to check when the drone reached a detour waypoint
+
+	DescentProfile descent_profile_; // descent speed scheduled by height above ground
+	TouchdownDetector touchdown_detector_; // declares landing from odometry, thrust and height
+	bool touchdown_armed_ = false; // feed odometry to touchdown_detector_ during a descent
+	bool touchdown_detected_ = false; // set by odomCallback when touchdown_detector_ declared landing
+	double ground_z_ = 0.0; // altitude of the ground under the current descent (m)
+	double land_rate_; // loop rate of the descent loops (Hz)
+	sensor_msgs::Range current_range_; // last rangefinder measurement
+	ros::Time range_stamp_; // receipt time of current_range_
+	double current_thrust_ = -1.0; // last normalized thrust target of the FCU, < 0 when unknown
+	ros::Time thrust_stamp_; // receipt time of current_thrust_
+	double heightAboveGround(); // rangefinder height when valid, otherwise odometry altitude above ground_z_
+	void startDescent(double ground_z); // arm the touchdown detector for a new descent
+	void rangefinderCallback(const sensor_msgs::Range::ConstPtr &msg); // rangefinder callback
+	void thrustCallback(const mavros_msgs::AttitudeTarget::ConstPtr &msg); // thrust target callback
+
+	MissionCheckpointFile checkpoint_file_; // persistent mission progress, disabled when checkpoint_file is empty
+	CheckpointWriter checkpoint_writer_; // saves the checkpoints of the flight loops and services on its own thread
+	MissionCheckpoint checkpoint_; // filled in place by saveCheckpoint, reserved by reserveContainers
+	bool resume_mission_; // continue the mission stored in checkpoint_file_ instead of starting a new one
+	int start_target_ = 0; // index of the first setpoint to fly (0 or the resumed one)
+	int deliveries_completed_ = 0; // number of packages dropped in this mission
+	bool returning_home_ = false; // every setpoint is done, the resumed mission only returns home and lands
+	void saveCheckpoint(int next_target, bool returning_home = false); // store mission progress (written by checkpoint_writer_)
+	bool resumeFromCheckpoint(); // restore mission progress, home and offsets
+
+	bool realtime_enable_; // run the control thread with SCHED_FIFO, CPU pinning and locked memory
+	RealtimeConfig realtime_config_; // realtime_cpu, realtime_priority
+	DeadlineMonitor deadline_monitor_; // control ticks that overran their period during the flight
+	bool async_log_enable_; // write flight messages through AsyncLogger instead of blocking printf
+	std::string log_file_; // file that also receives the flight messages, empty for console only
+	double log_period_; // minimum time between two per-tick messages (distance, rotating, ...) (s)
+	uint8_t log_source_ = 0; // AsyncLogger source of this vehicle: node namespace prefix and own rate limits
+	inline uint8_t logSource() const // used by OFFBOARD_LOG inside the members
+	{
+		return log_source_;
+	}
+	void sleepTick(ros::Rate &rate); // rate.sleep() of the mission loops, counts and reports missed deadlines
+	void reserveContainers(); // reserve setpoint and detour vectors so the flight loops do not allocate
+
+	bool mission_upload_enable_; // fly the setpoints as an FCU mission in AUTO.MISSION, OFFBOARD only for the final landing
+	bool precision_landing_; // land in OFFBOARD after the mission, otherwise the mission ends with NAV_LAND
+	ros::ServiceClient mission_push_client_; // upload mission items to the FCU
+	ros::ServiceClient mission_clear_client_; // clear the FCU mission
+	ros::Subscriber mission_reached_sub_; // reached mission item subscriber
+	int mission_reached_seq_ = -1; // last mission item reached by the FCU
+	std::vector<int> mission_item_target_; // setpoint index completed by each mission item, -1 for other items
+	mavros_msgs::Waypoint missionItem(uint16_t command, const Eigen::Vector3d &position, double hold_time); // mission item at an ENU position (relative altitude to home)
+	void appendMissionLeg(std::vector<mavros_msgs::Waypoint> &items, const Eigen::Vector3d &start, const Eigen::Vector3d &setpoint); // detour items of a blocked leg
+	void buildMission(std::vector<mavros_msgs::Waypoint> &items); // takeoff, setpoints, deliveries and return home as mission items
+	bool uploadMission(const std::vector<mavros_msgs::Waypoint> &items); // clear and push the mission through MAVROS
+	bool missionFlight(); // fly the mission in AUTO.MISSION and land, false if the upload failed
+	void missionReachedCallback(const mavros_msgs::WaypointReached::ConstPtr &msg); // reached mission item callback
+
+	bool marker_landing_enable_; // land on the marker at the final setpoint, searching for it when it is not in view
+	SearchPattern search_pattern_; // expanding square sized from the camera intrinsics
+	double search_radius_; // radius around the final setpoint to search (m)
+	int search_max_rings_; // rings of the square, the altitude is raised so they cover search_radius_
+	double search_max_altitude_; // highest search altitude, the marker is still detected there (m)
+	double search_velocity_; // speed along the search legs (m/s)
+	double marker_timeout_; // a marker position older than this is not a detection (s)
+	bool markerVisible(); // target marker detected recently
+	bool searchMarker(const Eigen::Vector3d &center, Eigen::Vector3d &marker); // fly the search pattern until the marker is detected
+	void landingAtMarker(const Eigen::Vector3d &setpoint); // final landing on the marker, or at setpoint when it is not found
+
+	ros::ServiceServer add_delivery_server_; // add a delivery point in flight
+	ros::ServiceServer cancel_delivery_server_; // cancel a pending delivery point in flight
+	ros::Publisher delivery_etas_pub_; // publish pending setpoints and their ETA
+	DeliveryPlanner delivery_planner_; // time-bounded re-planning of the remaining setpoints
+	std::vector<int> target_ids_; // delivery id of each setpoint in x/y/z_target_
+	int next_target_id_ = 0; // id given to the next added delivery
+	int current_target_ = 0; // index of the setpoint the flight loop is flying to
+	bool route_active_ = false; // the OFFBOARD flight loop is running and accepts route changes
+	bool route_changed_ = false; // setpoints changed by a service, the flight loop re-validates its leg
+	bool delivering_ = false; // the current setpoint is being delivered, the services leave it in place
+	DeliveryRoute eta_route_; // remaining route of publishEtas, reserved by reserveContainers
+	std::vector<double> eta_; // ETA of each setpoint of eta_route_ (s)
+	offboard::DeliveryEtas etas_msg_; // message of publishEtas, reserved by reserveContainers
+	void remainingRoute(DeliveryRoute &route); // setpoints from current_target_ to the final one
+	void applyRoute(const DeliveryRoute &route); // write the re-planned setpoints back, checkpoint and publish ETAs
+	double deliveryServiceTime(); // time spent at one drop: descent, unpack and climb (s)
+	void publishEtas(); // publish pending setpoints and their ETA
+	bool addDeliveryCallback(offboard::AddDelivery::Request &req, offboard::AddDelivery::Response &res); // add delivery service
+	bool cancelDeliveryCallback(offboard::CancelDelivery::Request &req, offboard::CancelDelivery::Response &res); // cancel delivery service
+
 	void waitForPredicate(double hz); // wait for connect, GPS received, ...
-	void setOffboardStream(double hz, geometry_msgs::PoseStamped first_target); // send a few setpoints before publish
+	void setOffboardStream(double hz, const geometry_msgs::PoseStamped &first_target); // send a few setpoints before publish
 	void waitForArmAndOffboard(double hz); // wait for ARM and OFFBOARD mode switch (in SITL case or HITL/Practical case)
+	void waitForOffboard(double hz); // resumed mission: stream the current position until armed in OFFBOARD, which may be airborne already
 	void waitForStable(double hz); // wait drone get a stable state
 	void stateCallback(const mavros_msgs::State::ConstPtr& msg); // state callback
 	void odomCallback(const nav_msgs::Odometry::ConstPtr& msg); // odometry callback
@@ -142,7 +293,7 @@ class OffboardControl
 	// DuyNguyen
 	void markerCallback(const geometry_msgs::PoseStamped::ConstPtr& msg); // call back the marker position 
 	void checkMoveCallback(const std_msgs::Bool msg); // check move to the centre of UAV
-	void checkIdsDetectionCallback(const std_msgs::Bool msg); // check have the ids or not ?
+	void checkIdsDetectionCallback(const std_msgs::Bool::ConstPtr &msg); // check have the ids or not ?
 	void poseCallback(const geometry_msgs::PoseStamped::ConstPtr & msg); // call back the current position
 
 	inline double degreeOf(double rad) // convert from radian to degree
@@ -161,6 +312,20 @@ class OffboardControl
         return x*x;
     }; 
 
+	inline Eigen::Vector3d positionOf(const geometry_msgs::Point &point) // convert position msg to Eigen vector (stack only, no allocation)
+	{
+		return Eigen::Vector3d(point.x, point.y, point.z);
+	}
+
+	inline Eigen::Vector3d driftCorrected(const Eigen::Vector3d &target) // setpoint moved with the odometry drift, so it stays at the same place on the ground
+	{
+		return target + drift_estimator_.drift();
+	}
+	inline Eigen::Vector3d currentPosition() // current ENU position from odometry
+	{
+		return positionOf(current_odom_.pose.pose.position);
+	}
+
 	void inputSetpoint(); // manage input: select mode, setpoint type, ...
 	void inputENU(); // manage input for ENU setpoint flight mode: manual input from keyboard, load setpoints
 	void enuFlight(); // perform flight with ENU (x,y,z) setpoints
@@ -176,24 +341,27 @@ class OffboardControl
 	void inputPlannerAndLanding(); // manage for flight with optimization point from planner
 	void plannerAndLandingFlight(); // perform flight with ENU (x,y,z) setpoints from optimization planner and Landing at marker
 
-	double calculateYawOffset(geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped setpoint); // calculate yaw offset between current position and next optimization position
+	double calculateYawOffset(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint); // calculate yaw offset between current position and next optimization position
 
-	void takeOff(geometry_msgs::PoseStamped setpoint, double hover_time); // perform takeoff task
-	void hovering(geometry_msgs::PoseStamped setpoint, double hover_time); // perform hover task
-	void landing(geometry_msgs::PoseStamped setpoint); // perform land task
-	void landingYaw(geometry_msgs::PoseStamped setpoint); // perform land task & Yaw
+	void takeOff(const geometry_msgs::PoseStamped &setpoint, double hover_time); // perform takeoff task
+	void hovering(const geometry_msgs::PoseStamped &setpoint, double hover_time); // perform hover task
+	void landing(const geometry_msgs::PoseStamped &setpoint); // perform land task
+	void landingYaw(const geometry_msgs::PoseStamped &setpoint); // perform land task & Yaw
 	
-	void returnHome(geometry_msgs::PoseStamped home_pose); // perform return home task
+	void returnHome(const geometry_msgs::PoseStamped &home_pose); // perform return home task
+	void returnHomeAndLand(double altitude); // return home at altitude and land there
 	void returnHomeYaw(geometry_msgs::PoseStamped home_pose); // perform return home task & Yaw
-	void delivery(geometry_msgs::PoseStamped setpoint, double unpack_time); // perform delivery task
+	void delivery(const geometry_msgs::PoseStamped &setpoint, double unpack_time); // perform delivery task
 	void deliveryHover(geometry_msgs::PoseStamped setpoint, double unpack_time); // perform delivery task
+
+	void publishTarget(const Eigen::Vector3d &position, const geometry_msgs::Quaternion &orientation); // fill target_enu_pose_ in place and publish it
 	
 	sensor_msgs::NavSatFix goalTransfer(double lat, double lon, double alt); // transfer lat, lon, alt setpoint to same message type with gps setpoint msg
 	geometry_msgs::PoseStamped targetTransfer(double x, double y, double z); // transfer x, y, z setpoint to same message type with enu setpoint msg
 	geometry_msgs::PoseStamped targetTransfer(double x, double y, double z, double yaw); // transfer x, y, z (meter) and yaw (degree) setpoint to same message type with enu setpoint msg
 	geometry_msgs::PoseStamped targetTransfer(double x, double y, double z, geometry_msgs::Quaternion yaw);
 
-	bool checkPositionError(double error, geometry_msgs::PoseStamped target); // check offset between current position from odometry and setpoint position to decide when drone reached setpoint
+	bool checkPositionError(double error, const Eigen::Vector3d &target); // check offset between current position from odometry and setpoint position to decide when drone reached setpoint
 	bool checkPositionError(double error, geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target); // check offset between current position and setpoint position to decide when drone reached setpoint
 	bool checkOrientationError(double error, geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target); // check offset between current orientation and setpoint orientation to decide when drone reached setpoint
 
@@ -202,8 +370,8 @@ class OffboardControl
 	Eigen::Vector3d getRPY(geometry_msgs::Quaternion quat); // get roll, pitch and yaw angle from quaternion
 	// geometry_msgs::Quaternion getQuaternionMsg(double roll, double pitch, double yaw); // create quaternion msg from roll, pitch and yaw
 	
-	double distanceBetween(geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target); // calculate distance between current position and setpoint position
-	geometry_msgs::Vector3 velComponentsCalc(double v_desired, geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target); // calculate components of velocity about x, y, z axis
+	double distanceBetween(const Eigen::Vector3d &current, const Eigen::Vector3d &target); // calculate distance between current position and setpoint position
+	Eigen::Vector3d velComponentsCalc(double v_desired, const Eigen::Vector3d &current, const Eigen::Vector3d &target); // calculate components of velocity about x, y, z axis
 
 	geometry_msgs::Point WGS84ToECEF(sensor_msgs::NavSatFix wgs84); // convert from WGS84 GPS (LLA) to ECEF x,y,z
 	geographic_msgs::GeoPoint ECEFToWGS84(geometry_msgs::Point ecef); // convert from ECEF x,y,z to WGS84 GPS (LLA)  
@@ -213,8 +381,4 @@ class OffboardControl
 	geographic_msgs::GeoPoint ENUToWGS84(geometry_msgs::Point enu, sensor_msgs::NavSatFix ref); // convert from ENU x,y,z to WGS84 GPS (LLA)
 };
 
-double yaw_;
-Eigen::Affine3d current_pose_ = Eigen::Affine3d::Identity();
-Eigen::Vector3d current_velocity_ = Eigen::Vector3d::Zero();
-
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+#include<cstddef>
+
+/* real-time settings of the control thread */
+struct RealtimeConfig
+{
+	int cpu = -1; // core to pin the thread to, < 0 keeps the default affinity
+	int priority = 80; // SCHED_FIFO priority (1..99)
+	bool lock_memory = true; // mlockall current and future pages of the process
+	size_t stack_prefault = 512 * 1024; // bytes of stack touched after locking, so the loops never page fault on it (B)
+};
+
+/* switch the calling thread to real-time: SCHED_FIFO, CPU pinning, locked and pre-faulted memory
+   threads created afterwards by the calling thread inherit policy and affinity.
+   Every step is tried, failures (e.g. missing CAP_SYS_NICE / rtprio limits) are printed; returns true when all succeeded */
+bool enterRealtime(const RealtimeConfig &config);
+
+/* give the calling thread the default policy back: SCHED_OTHER on every CPU
+   for helper threads started by a real-time thread, so they do not compete with it on its core */
+bool leaveRealtime();
+
+/* counter of control ticks that overran their period */
+class DeadlineMonitor
+{
+  public:
+	void reset(); // start counting, e.g. at takeoff
+	bool tick(bool met, double cycle_time); // record one tick (met: rate.sleep() result, cycle_time: work time in s), true on a miss
+	long ticks() const { return ticks_; }
+	long missed() const { return missed_; }
+	double worstCycle() const { return worst_cycle_; } // longest work time of a tick (s)
+
+  private:
+	long ticks_ = 0;
+	long missed_ = 0;
+	double worst_cycle_ = 0.0;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SEARCH_PATTERN_H_
+#define SEARCH_PATTERN_H_
+
+#include<eigen3/Eigen/Dense>
+#include<eigen3/Eigen/StdVector>
+
+#include<vector>
+
+/* expanding-square search for a landing marker with a downward camera
+   the ground footprint of the camera (pinhole model, fx, fy in pixels) sets the leg spacing,
+   so consecutive passes overlap by the given fraction whatever the altitude */
+class SearchPattern
+{
+  public:
+	SearchPattern(double fx = 391.5, double fy = 391.5, double width = 720.0, double height = 480.0, double overlap = 0.2);
+
+	double footprintWidth(double altitude) const { return altitude * width_ / fx_; } // ground coverage along the image x axis (m)
+	double footprintHeight(double altitude) const { return altitude * height_ / fy_; } // ground coverage along the image y axis (m)
+	double spacing(double altitude) const; // distance between parallel passes (m), independent of the heading
+	double altitudeFor(double radius, int max_rings, double min_altitude, double max_altitude) const; // lowest altitude covering radius in max_rings rings, clamped
+	void expandingSquare(const Eigen::Vector3d &center, double radius, std::vector<Eigen::Vector3d> &waypoints) const; // legs of 1, 1, 2, 2, 3, 3, ... spacings around center until radius is covered, at center.z()
+
+  private:
+	double fx_, fy_; // focal lengths (px)
+	double width_, height_; // image size (px)
+	double overlap_; // overlap of neighbouring passes (0..1)
+
+	static const int MAX_LEGS = 64; // bound on the pattern size
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPATIAL_MAP_H_
+#define SPATIAL_MAP_H_
+
+#include<eigen3/Eigen/Dense>
+#include<eigen3/Eigen/StdVector>
+
+#include<cstdint>
+#include<string>
+#include<unordered_set>
+#include<vector>
+
+/* obstacle and geofence map in the local ENU frame
+   obstacles are kept in a hashed voxel grid (already inflated by the safety margin),
+   geofences are vertical polygonal prisms (keep-out zones and an optional keep-in area)
+
+   map file (plain text, '#' starts a comment):
+     voxel_size 0.5
+     box xmin ymin zmin xmax ymax zmax    occupied box
+     voxel x y z                          single occupied point
+     keep_out zmin zmax x1 y1 x2 y2 ...   no-fly polygon between zmin and zmax
+     keep_in zmin zmax x1 y1 x2 y2 ...    flight area, leaving it is not allowed
+     min_altitude z                       lowest altitude of planned detours, default: ground (z = 0) + safety margin */
+class SpatialMap
+{
+  public:
+	SpatialMap();
+
+	bool load(const std::string &file, double inflation); // load map file and inflate obstacles by inflation (m)
+	bool empty() const; // no obstacle and no geofence loaded
+
+	bool pointFree(const Eigen::Vector3d &point) const; // check a point against voxels and geofences
+	bool segmentFree(const Eigen::Vector3d &start, const Eigen::Vector3d &end) const; // check a straight segment against voxels and geofences
+	bool planDetour(const Eigen::Vector3d &start, const Eigen::Vector3d &goal, std::vector<Eigen::Vector3d> &waypoints) const; // A* on the voxel grid + line of sight shortcuts, waypoints end with goal (a start inside the safety margin leaves it first)
+
+	size_t numVoxels() const { return occupied_.size(); }
+	size_t numGeofences() const { return fences_.size(); }
+
+  private:
+	typedef std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> Polygon;
+
+	struct Geofence
+	{
+		Polygon polygon; // vertices in x, y (m)
+		double z_min, z_max; // altitude band of the prism (m)
+		bool keep_in; // true: flight area, false: keep-out zone
+	};
+
+	double voxel_size_; // edge of a voxel (m)
+	double inflation_; // safety margin around obstacles and keep-out zones (m)
+	std::unordered_set<int64_t> occupied_; // keys of occupied (inflated) voxels
+	std::vector<Geofence> fences_; // loaded geofences
+
+	double min_altitude_ = 0.0; // lowest altitude of planned detours, set by load() (m)
+	double search_margin_ = 20.0; // A* search box around start and goal (m)
+	int max_expansions_ = 200000; // A* node budget
+
+	int64_t keyOf(int ix, int iy, int iz) const; // pack voxel indexes into one hash key
+	Eigen::Vector3i indexOf(const Eigen::Vector3d &point) const; // voxel containing a point
+	Eigen::Vector3d centerOf(const Eigen::Vector3i &index) const; // center of a voxel
+	bool voxelOccupied(const Eigen::Vector3i &index) const;
+	void addOccupied(const Eigen::Vector3d &point); // mark a point occupied including inflation
+	bool cutsCorner(const Eigen::Vector3i &index, const Eigen::Vector3i &move) const; // diagonal A* step touching an occupied voxel
+	int floorIndex(double z) const; // lowest voxel layer of a search: the one of min_altitude_, or of z when lower (a leg starting or ending near the ground)
+	bool nearestFree(const Eigen::Vector3d &point, Eigen::Vector3d &free) const; // closest free voxel center within the safety margin of point, not below floorIndex
+
+	bool fenceBlocks(const Geofence &fence, const Eigen::Vector3d &start, const Eigen::Vector3d &end) const; // segment vs one geofence
+	bool voxelsBlock(const Eigen::Vector3d &start, const Eigen::Vector3d &end) const; // 3D DDA voxel traversal
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TOPIC_WATCHDOG_H_
+#define TOPIC_WATCHDOG_H_
+
+#include<ros/ros.h>
+#include<ros/callback_queue.h>
+
+#include<mavros_msgs/SetMode.h>
+#include<nav_msgs/Odometry.h>
+#include<sensor_msgs/NavSatFix.h>
+#include<diagnostic_msgs/DiagnosticArray.h>
+
+#include<atomic>
+#include<chrono>
+#include<mutex>
+#include<string>
+#include<thread>
+
+/* staleness watchdog of the MAVROS inputs
+   odometry and GPS are received again on a private callback queue serviced by a dedicated thread,
+   so a stalled or busy mission loop does not hide a stalled MAVROS. When the vehicle flies (setActive)
+   and a topic misses its deadline or drops below its minimum rate, the watchdog trips within one
+   check period: it switches the FCU to failsafe_mode, raises an ERROR diagnostic and stays tripped.
+   Mode requests of the mission thread go through setMode(), so they never race the failsafe request */
+class TopicWatchdog
+{
+  public:
+	TopicWatchdog(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private);
+	~TopicWatchdog();
+
+	void start(); // start the watchdog thread (no-op when watchdog_enable is false)
+	void stop(); // stop and join the watchdog thread
+	void setActive(bool active); // trip only while active (vehicle armed and flown by this node)
+	bool tripped() const { return tripped_; }
+	bool setMode(ros::ServiceClient &client, mavros_msgs::SetMode &mode); // call set_mode unless tripped, serialized with the failsafe request
+
+  private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct TopicStatus
+	{
+		std::string name; // topic name shown in diagnostics
+		double deadline; // maximum age of the last message (s)
+		double min_rate; // minimum receive rate (Hz), 0 disables the rate check
+		Clock::time_point last; // receipt time of the last message
+		double interval = 0.0; // filtered interval between messages (s), 0 until two messages arrived
+		bool received = false; // at least one message arrived
+		bool stale = false; // last check result
+	};
+
+	ros::NodeHandle nh_;
+	ros::NodeHandle nh_private_;
+	ros::CallbackQueue callback_queue_; // watchdog callbacks only, serviced by thread_
+
+	ros::Subscriber odom_sub_; // odometry receipt subscriber
+	ros::Subscriber gps_sub_; // GPS receipt subscriber
+	ros::Publisher diagnostics_pub_; // publish topic health to /diagnostics
+	ros::ServiceClient set_mode_client_; // own client, called from the watchdog thread
+
+	TopicStatus odom_; // odometry health
+	TopicStatus gps_; // GPS health
+	bool enable_; // watchdog_enable parameter
+	double period_; // check period (s), bounds the detection latency together with the deadlines
+	std::string failsafe_mode_; // FCU mode requested when tripping (e.g. AUTO.LOITER, AUTO.LAND)
+	Clock::time_point started_; // topics never received are measured from the start of the thread
+	Clock::time_point last_diagnostics_; // last periodic diagnostics publication
+
+	std::thread thread_;
+	std::atomic<bool> running_; // thread keeps going while set
+	std::atomic<bool> active_; // trip allowed
+	std::atomic<bool> tripped_; // failsafe triggered
+	std::mutex mode_mutex_; // serializes the failsafe and the mode requests of the mission thread
+
+	void run(); // watchdog thread: service callbacks and check deadlines every period_
+	void check(Clock::time_point now); // update staleness of every topic, trip if needed
+	bool updateStatus(TopicStatus &topic, Clock::time_point now); // true when the topic is stale
+	void received(TopicStatus &topic); // record a message receipt
+	void trip(const TopicStatus &topic, Clock::time_point now); // request failsafe mode and report
+	void publishDiagnostics(Clock::time_point now); // publish health of all topics
+	void odomCallback(const nav_msgs::Odometry::ConstPtr &msg);
+	void gpsCallback(const sensor_msgs::NavSatFix::ConstPtr &msg);
+};
+
+#endif
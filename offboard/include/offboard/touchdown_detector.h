@@ -0,0 +1,57 @@
+#ifndef TOUCHDOWN_DETECTOR_H_
+#define TOUCHDOWN_DETECTOR_H_
+
+#include<array>
+
+/* descent speed scheduled by height above ground:
+   fast_velocity above slow_height + blend_height, slow_velocity below slow_height, linear in between */
+struct DescentProfile
+{
+	double fast_velocity = 0.7; // descent speed high above ground (m/s)
+	double slow_velocity = 0.2; // descent speed in the final part (m/s)
+	double slow_height = 1.0; // height where the slow descent starts (m)
+	double blend_height = 1.0; // height band used to blend from fast to slow (m)
+
+	double velocity(double height) const; // descent speed at a height above ground
+};
+
+/* in-node touchdown detector
+   landing is declared when, over the whole window, the vehicle is close to the ground, the vertical
+   speed stays near zero, the altitude does not change any more and (when known) the FCU thrust
+   dropped below the hover level. Samples live in a fixed ring buffer, adding one never allocates */
+class TouchdownDetector
+{
+  public:
+	TouchdownDetector();
+
+	void configure(double window, double max_speed, double max_spread, double max_height, double max_thrust); // set thresholds
+	void reset(); // forget all samples, called when a descent starts
+	bool addSample(double time, double height, double z, double vz, double thrust); // add odometry sample (thrust < 0 if unknown), returns landed()
+	bool landed() const { return landed_; }
+
+  private:
+	struct Sample
+	{
+		double time; // stamp (s)
+		double height; // height above ground (m)
+		double z; // altitude from odometry (m)
+		double vz; // vertical velocity (m/s)
+		double thrust; // normalized thrust of the FCU, < 0 when unknown
+	};
+
+	static const int CAPACITY = 64; // samples kept, enough for the window at odometry rate
+	std::array<Sample, CAPACITY> samples_;
+	int head_ = 0; // index of the next sample to write
+	int count_ = 0; // number of valid samples
+
+	double window_ = 0.1; // time the touchdown conditions must hold (s)
+	double max_speed_ = 0.1; // maximum vertical speed on the ground (m/s)
+	double max_spread_ = 0.03; // maximum altitude change over the window (m)
+	double max_height_ = 0.3; // maximum height above ground (m)
+	double max_thrust_ = 0.25; // maximum thrust on the ground (normalized)
+	bool landed_ = false;
+
+	bool evaluate() const; // check the touchdown conditions over the window
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include<atomic>
+#include<condition_variable>
+#include<cstdint>
+#include<deque>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+/* fixed set of worker threads, one task deque per worker
+   a worker takes the newest task of its own deque and, when it is empty, steals the oldest task of another one.
+   Tasks submitted by a worker go to its own deque, the others are dealt round-robin. Deques are guarded by
+   a mutex each: tasks are coarse (a batch of simulated missions), contention is negligible */
+class WorkStealingPool
+{
+  public:
+	explicit WorkStealingPool(unsigned threads = 0); // 0: one worker per hardware thread
+	~WorkStealingPool();
+
+	void submit(std::function<void()> task);
+	void wait(); // block until every submitted task has run
+	unsigned size() const { return static_cast<unsigned>(threads_.size()); }
+	uint64_t steals() const { return steals_; } // tasks run by another worker than the one they were queued on
+
+  private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_; // guards the sleep of idle workers and of wait()
+	std::condition_variable wake_; // a task was queued or the pool stops
+	std::condition_variable done_; // pending_ dropped to 0
+	std::atomic<size_t> queued_{0}; // tasks in the deques
+	std::atomic<size_t> pending_{0}; // tasks submitted and not finished
+	std::atomic<unsigned> next_{0}; // round-robin deque of external submissions
+	std::atomic<uint64_t> steals_{0};
+	bool stopping_ = false;
+
+	bool take(unsigned index, std::function<void()> &task); // own deque first, then steal
+	void run(unsigned index);
+};
+
+#endif
@@ -12,6 +12,8 @@ from geometry_msgs.msg import PoseStamped as PS
 # from nav_msgs.msg import Odometry
 # from mavros_msgs.msg import PositionTarget as PT
 import transform as tr
+from debug_image import DebugImagePublisher
+from camera_model import CameraModel, default_calibration
 # from std_msgs.msg import Float32
 # from tf import transformations as tr
 # import mavros_msgs.msg
@@ -29,9 +31,8 @@ class MarkerDetector:
         mavros.set_namespace('mavros')
 
         # Setup subscribers
-        ## Image
-        # video_topic = "iris_fpv_cam/usb_cam/image_raw"
-        video_topic = "/camera/color/image_raw"
+        ## Image (SITL: /iris_fpv_cam/usb_cam/image_raw with _camera_info_url:=.../config/sitl_cam.yaml)
+        video_topic = rospy.get_param('~image_topic', "/camera/color/image_raw")
         image_subscriber = rospy.Subscriber(video_topic, Image, self.image_callback)
         self.bridge = CvBridge()
 
@@ -43,7 +44,9 @@ class MarkerDetector:
         # Set up publishers
         self.aruco_marker_pos_pub = rospy.Publisher('/aruco_marker_pos', PS, queue_size=10)
         self.fly_pos_pub = rospy.Publisher('/target_pos', PS, queue_size=10)
-        self.aruco_marker_img_pub = rospy.Publisher('/aruco_marker_img', Image, queue_size=10)
+        # debug image: only drawn when subscribed, throttled, downscaled and JPEG compressed
+        self.aruco_marker_img_pub = DebugImagePublisher('/aruco_marker_img',
+            rospy.get_param('~debug_image_rate', 5.0), rospy.get_param('~debug_image_scale', 0.5))
         self.check_move_position = rospy.Publisher('/move_position', Bool, queue_size=10) 
         self.check_marker_detection = rospy.Publisher('/ids_detection', Bool, queue_size=10) 
 
@@ -60,13 +63,9 @@ class MarkerDetector:
         # transformation matrix from imu to camera 4x4
         self.imu_cam = np.zeros((4,4), dtype=np.float)
 
-        ## camera intristic parameters fpv_cam
-        # self.K = np.array([277.191356, 0.0, 160.5, 0.0, 277.191356, 120.5, 0.0, 0.0, 1.0]).reshape(3,3)
-        # self.distCoeffs = np.array([0.0] * 5)
-
-        ## camera intristic parameters real_cam
-        self.K = np.array([391.49725341796875, 0.0, 360.0, 0.0, 391.49725341796875, 240.0, 0.0, 0.0, 1.0]).reshape(3,3)
-        self.distCoeffs = np.array([0.0] * 5)
+        ## camera intrinsics and distortion: camera_info next to the image topic, else the calibration file
+        self.camera = CameraModel.from_params(default_calibration('color_cam.yaml'),
+            video_topic.rsplit('/', 1)[0] + '/camera_info')
 
         #Load the dictionary that was used to generate the markers.
         # self.dictionary = cv.aruco.Dictionary_get(cv.aruco.DICT_6X6_250)
@@ -136,7 +135,8 @@ class MarkerDetector:
         while not rospy.is_shutdown():
             # print(self.pos[0])
             """ Use the build in python library to detect the aruco marker and its coordinates """
-            img = self.frame.copy() 
+            # detection does not modify the frame, it is only copied when the debug overlay is drawn
+            img = self.frame
         
             # Detect the markers in the image
             markerCorners, markerIds, rejectedCandidates = cv.aruco.detectMarkers(img, self.dictionary, parameters=self.parameters)
@@ -148,12 +148,15 @@ class MarkerDetector:
                     # if self.altitude > 3.5:
                     if markerIds[i][0] == self.ids_target[0]:
                         # get corner at index i responsible id at index 0
-                        self.corners = markerCorners[i]
+                        # only the 4 corners are undistorted, the pose is then solved on the ideal pinhole camera
+                        self.corners = self.camera.undistort_corners(markerCorners[i])
+                        if self.corners is None:
+                            continue
 
                         markerSize = 0.4
                         axisLength = 1.0
 
-                        ret1 = cv.aruco.estimatePoseSingleMarkers( self.corners, markerSize, self.K, self.distCoeffs)
+                        ret1 = cv.aruco.estimatePoseSingleMarkers( self.corners, markerSize, self.camera.K, self.camera.dist_pose)
                         rvecs, tvecs = ret1[0][0,0,:],ret1[1][0,0,:]
                         
                         tvec1[0][0] = tvecs[0]
@@ -189,9 +192,10 @@ class MarkerDetector:
                         # publish marker in body frame
                         self.fly_pos_pub.publish(fly_pos)
 
-                        frame_out = cv.aruco.drawAxis(img, self.K, self.distCoeffs, rvecs, tvecs, axisLength)
+                        if self.aruco_marker_img_pub.wanted():
+                            frame_out = cv.aruco.drawAxis(img.copy(), self.camera.K, self.camera.D, rvecs, tvecs, axisLength)
+                            self.aruco_marker_img_pub.publish(frame_out)
                         # self.aruco_marker_pos_pub.publish(marker_pos)
-                        self.aruco_marker_img_pub.publish(self.bridge.cv2_to_imgmsg(frame_out, "bgr8"))
                         print(markerSize)
                         self.rate.sleep()
                             
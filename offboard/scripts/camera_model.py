@@ -0,0 +1,112 @@
+#! /usr/bin/env python
+
+import os
+import yaml
+import rospy
+import rospkg
+import cv2 as cv
+import numpy as np
+from sensor_msgs.msg import CameraInfo
+
+
+def default_calibration(name):
+    """ Path of a calibration file shipped in offboard/config """
+    return os.path.join(rospkg.RosPack().get_path('offboard'), 'config', name)
+
+
+class CameraModel(object):
+    """
+        Calibrated pinhole camera with lens distortion (camera_calibration / camera_info format).
+        Only the detected marker corners are undistorted, never the whole frame: cv.undistortPoints
+        is evaluated once on a grid of the image (every lut_step pixels) and the corners are
+        bilinearly interpolated in this lookup table. The undistorted corners are ideal pinhole
+        pixels of K, so the pose is estimated with K and no distortion (dist_pose); overlays on
+        the raw frame are drawn with K and D.
+    """
+    def __init__(self, K, D, width, height, lut_step=4):
+        self.K = np.array(K, dtype=np.float64).reshape(3, 3)
+        self.D = np.array(D, dtype=np.float64).reshape(-1)
+        self.width = int(width)
+        self.height = int(height)
+        self.dist_pose = np.zeros(5)
+        self.lut_step = float(lut_step)
+        self.lut = None
+        if np.any(self.D != 0.0):
+            self._build_lut()
+
+    @classmethod
+    def from_yaml(cls, path, lut_step=4):
+        """ Load a calibration file written by camera_calibration (camera_info_manager format) """
+        with open(path) as f:
+            calib = yaml.safe_load(f)
+        return cls(calib['camera_matrix']['data'], calib['distortion_coefficients']['data'],
+                   calib['image_width'], calib['image_height'], lut_step)
+
+    @classmethod
+    def from_camera_info(cls, msg, lut_step=4):
+        return cls(msg.K, msg.D, msg.width, msg.height, lut_step)
+
+    @classmethod
+    def from_params(cls, default_yaml, default_topic=''):
+        """
+            ~camera_info_topic: wait up to ~camera_info_timeout (s) for a CameraInfo on it,
+            then ~camera_info_url: calibration YAML, used when the topic is empty or silent
+        """
+        topic = rospy.get_param('~camera_info_topic', default_topic)
+        lut_step = rospy.get_param('~undistort_lut_step', 4)
+        if topic:
+            try:
+                msg = rospy.wait_for_message(topic, CameraInfo, rospy.get_param('~camera_info_timeout', 2.0))
+                if msg.K[0] > 0.0:
+                    rospy.loginfo('Camera model from %s', topic)
+                    return cls.from_camera_info(msg, lut_step)
+            except rospy.ROSException:
+                rospy.logwarn('No camera_info on %s, loading the calibration file', topic)
+        path = rospy.get_param('~camera_info_url', default_yaml)
+        if path.startswith('file://'):
+            path = path[len('file://'):]
+        rospy.loginfo('Camera model from %s', path)
+        return cls.from_yaml(os.path.expanduser(path), lut_step)
+
+    def _build_lut(self):
+        # grid including the last row and column, so every pixel of the image has 4 neighbours
+        xs = np.append(np.arange(0.0, self.width - 1, self.lut_step), self.width - 1)
+        ys = np.append(np.arange(0.0, self.height - 1, self.lut_step), self.height - 1)
+        grid = np.stack(np.meshgrid(xs, ys), axis=-1).reshape(-1, 1, 2).astype(np.float32)
+        normalized = cv.undistortPoints(grid, self.K, self.D)
+        # strong distortion folds the lens model near the image corners, where the iteration of
+        # undistortPoints does not converge: entries that do not project back onto their pixel are invalid
+        rays = np.concatenate([normalized.reshape(-1, 2), np.ones((len(grid), 1))], axis=1)
+        projected, _ = cv.projectPoints(rays, np.zeros(3), np.zeros(3), self.K, self.D)
+        valid = np.linalg.norm(projected.reshape(-1, 2) - grid.reshape(-1, 2), axis=1) < 0.5
+        undistorted = np.dot(rays, self.K.T)[:, :2]
+        undistorted[~valid] = np.nan
+        self.lut_x = xs
+        self.lut_y = ys
+        self.lut = undistorted.reshape(len(ys), len(xs), 2)
+
+    def undistort_points(self, points):
+        """ Undistort pixel points, array of shape (N, 2), NaN where the lens model is not invertible """
+        points = np.asarray(points, dtype=np.float64).reshape(-1, 2)
+        if self.lut is None:
+            return points
+        nx = len(self.lut_x) - 1
+        ny = len(self.lut_y) - 1
+        u = np.clip(points[:, 0], 0.0, self.width - 1.0)
+        v = np.clip(points[:, 1], 0.0, self.height - 1.0)
+        i = np.minimum(np.searchsorted(self.lut_x, u, side='right') - 1, nx - 1)
+        j = np.minimum(np.searchsorted(self.lut_y, v, side='right') - 1, ny - 1)
+        a = ((u - self.lut_x[i]) / (self.lut_x[i + 1] - self.lut_x[i]))[:, None]
+        b = ((v - self.lut_y[j]) / (self.lut_y[j + 1] - self.lut_y[j]))[:, None]
+        result = ((1 - a) * (1 - b) * self.lut[j, i] + a * (1 - b) * self.lut[j, i + 1] +
+                  (1 - a) * b * self.lut[j + 1, i] + a * b * self.lut[j + 1, i + 1])
+        # corners outside the image (clipped above) keep the offset of the border
+        return result + np.stack([points[:, 0] - u, points[:, 1] - v], axis=-1)
+
+    def undistort_corners(self, corners):
+        """ Undistort the corners of one aruco detection, array of shape (1, 4, 2), None if not possible """
+        corners = np.asarray(corners)
+        undistorted = self.undistort_points(corners)
+        if np.isnan(undistorted).any():
+            return None
+        return undistorted.reshape(corners.shape).astype(np.float32)
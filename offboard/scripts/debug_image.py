@@ -0,0 +1,41 @@
+#! /usr/bin/env python
+
+import rospy
+import cv2 as cv
+from sensor_msgs.msg import CompressedImage
+
+
+class DebugImagePublisher(object):
+    """
+        Lazy, throttled and downscaled debug image stream.
+        Frames are published as JPEG on <topic>/compressed, the topic name used by the
+        image_transport 'compressed' transport, so rqt_image_view / image_view can show <topic>.
+        Call wanted() before drawing overlays: nothing is drawn, scaled or encoded
+        when nobody is subscribed or the previous frame is too recent.
+    """
+    def __init__(self, topic, rate=5.0, scale=0.5, quality=80):
+        self.pub = rospy.Publisher(topic + '/compressed', CompressedImage, queue_size=1)
+        self.period = 1.0 / rate if rate > 0.0 else 0.0
+        self.scale = scale
+        self.quality = int(quality)
+        self.last = 0.0
+
+    def wanted(self):
+        """ True when a debug frame should be drawn and published now """
+        if self.pub.get_num_connections() == 0:
+            return False
+        return (rospy.get_time() - self.last) >= self.period
+
+    def publish(self, frame):
+        """ Downscale, JPEG encode and publish a frame """
+        self.last = rospy.get_time()
+        if self.scale > 0.0 and self.scale != 1.0:
+            frame = cv.resize(frame, None, fx=self.scale, fy=self.scale, interpolation=cv.INTER_AREA)
+        ok, buf = cv.imencode('.jpg', frame, [int(cv.IMWRITE_JPEG_QUALITY), self.quality])
+        if not ok:
+            return
+        msg = CompressedImage()
+        msg.header.stamp = rospy.Time.now()
+        msg.format = 'jpeg'
+        msg.data = buf.tobytes()
+        self.pub.publish(msg)
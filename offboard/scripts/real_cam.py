@@ -11,6 +11,8 @@ from geometry_msgs.msg import PoseStamped as PS
 from std_msgs.msg import Float64
 from mavros import setpoint as SP
 import transform as tr
+from debug_image import DebugImagePublisher
+from camera_model import CameraModel, default_calibration
 from std_msgs.msg import Bool
 
 
@@ -24,9 +26,8 @@ class MarkerDetector():
         self.config = rs.config()
 
         # self.cap = cv2.VideoCapture(0)
-        # self.mtx = np.array([5.9778919413469134e+02, 0.0, 3.2893543056979632e+02, 0.0, 6.0031367126366081e+02, 2.4530312117189993e+02, 0.0, 0.0, 1.0]).reshape(3,3)
-        self.mtx = np.array([917.497, 0.0, 635.002, 0.0, 915.865, 368.915, 0.0, 0.0, 1.0]).reshape(3,3)
-        self.dist = np.array([7.2697873963251586e-02, -1.4749282442847444e-01, -2.3233094539353212e-03, 8.9165121414591982e-03,-2.6332902664556002e-01])
+        # calibration of the color stream, its resolution is the one streamed
+        self.camera = CameraModel.from_params(default_calibration('real_cam.yaml'))
 
         # matrix from imu to camera
         self.imu_cam = np.zeros((4,4), dtype=np.float)
@@ -38,6 +39,11 @@ class MarkerDetector():
         self.fly_pos_pub = rospy.Publisher('/target_pos', PS, queue_size=10)
         self.check_move_position = rospy.Publisher('/move_position', Bool, queue_size=10) 
         self.check_marker_detection = rospy.Publisher('/ids_detection', Bool, queue_size=10) 
+        # debug image: only drawn when subscribed, throttled, downscaled and JPEG compressed
+        self.aruco_marker_img_pub = DebugImagePublisher('/aruco_marker_img',
+            rospy.get_param('~debug_image_rate', 5.0), rospy.get_param('~debug_image_scale', 0.5))
+        # local window with the overlays (needs a display)
+        self.show_window = rospy.get_param('~show_window', False)
         # self.target_position = rospy.Publisher('/target_position', PS, queue_size=10)
         # self.check_move_position = rospy.Publisher('/move_position', Bool, queue_size=10) 
         # self.check_error_pos = rospy.Publisher('/check_error_pos', Float64, queue_size=10)
@@ -83,7 +89,7 @@ class MarkerDetector():
         device = pipeline_profile.get_device()
         device_product_line = str(device.get_info(rs.camera_info.product_line))
 
-        self.config.enable_stream(rs.stream.color, 1280, 720, rs.format.bgr8, 30)
+        self.config.enable_stream(rs.stream.color, self.camera.width, self.camera.height, rs.format.bgr8, 30)
         self.pipeline.start(self.config)
 
         # self.cap.set(3, 1280)
@@ -125,6 +131,8 @@ class MarkerDetector():
             
             # lists of ids and the corners belonging to each id
             corners, ids, rejectedImgPoints = aruco.detectMarkers(gray, self.dict, parameters=self.param)
+            # overlays are drawn only when someone looks at them
+            draw = self.show_window or self.aruco_marker_img_pub.wanted()
             # aruco.drawDetectedMarkers(frame, corners, ids)
             if np.all(ids is not None):
                 ids_marker = True
@@ -132,16 +140,20 @@ class MarkerDetector():
                 for i in range(0, ids.size):
                     if self.altitude > 3.5:
                         if ids[i][0] == self.ids_target[0]:
-                            self.corners = corners[i]
+                            # only the 4 corners are undistorted, the pose is then solved on the ideal pinhole camera
+                            self.corners = self.camera.undistort_corners(corners[i])
+                            if self.corners is None:
+                                continue
 
                             markerLength=0.4
 
                             ret1 = aruco.estimatePoseSingleMarkers(corners=self.corners, markerLength = markerLength,
-                                                                cameraMatrix=self.mtx, distCoeffs=self.dist)
+                                                                cameraMatrix=self.camera.K, distCoeffs=self.camera.dist_pose)
                             rvec, tvec = ret1[0][0, 0, :], ret1[1][0, 0, :]
                             # -- Draw the detected marker and put a reference frame over it
-                            aruco.drawDetectedMarkers(frame, corners, ids)
-                            aruco.drawAxis(frame, self.mtx, self.dist, rvec, tvec, 0.2)
+                            if draw:
+                                aruco.drawDetectedMarkers(frame, corners, ids)
+                                aruco.drawAxis(frame, self.camera.K, self.camera.D, rvec, tvec, 0.2)
                             
                             (rvec - tvec).any()  # get rid of that nasty numpy value array error
                             
@@ -175,8 +187,9 @@ class MarkerDetector():
                             fly_pos.pose.position.y = tvec2[1][0] + self.local_pos[1]
                             fly_pos.pose.position.z = tvec2[2][0] + self.local_pos[2]
 
-                            str_position0 = "Marker Position: x=%f  y=%f  z=%f" % (fly_pos.pose.position.x, fly_pos.pose.position.y, fly_pos.pose.position.z)
-                            cv2.putText(frame, str_position0, (0, 50), self.font, 0.7, (0, 255, 0), 1, cv2.LINE_AA)
+                            if draw:
+                                str_position0 = "Marker Position: x=%f  y=%f  z=%f" % (fly_pos.pose.position.x, fly_pos.pose.position.y, fly_pos.pose.position.z)
+                                cv2.putText(frame, str_position0, (0, 50), self.font, 0.7, (0, 255, 0), 1, cv2.LINE_AA)
                             # publish marker in body frame
                             self.fly_pos_pub.publish(fly_pos)
                             self.rate.sleep()
@@ -184,16 +197,20 @@ class MarkerDetector():
                     else:
                         if ids[i][0] == self.ids_target[1]:
                             # get corner at index i responsible id at index 1
-                            self.corners = corners[i]
+                            # only the 4 corners are undistorted, the pose is then solved on the ideal pinhole camera
+                            self.corners = self.camera.undistort_corners(corners[i])
+                            if self.corners is None:
+                                continue
 
                             markerLength=0.2
 
                             ret1 = aruco.estimatePoseSingleMarkers(corners=self.corners, markerLength = markerLength,
-                                                                cameraMatrix=self.mtx, distCoeffs=self.dist)
+                                                                cameraMatrix=self.camera.K, distCoeffs=self.camera.dist_pose)
                             rvec, tvec = ret1[0][0, 0, :], ret1[1][0, 0, :]
                             # -- Draw the detected marker and put a reference frame over it
-                            aruco.drawDetectedMarkers(frame, corners, ids)
-                            aruco.drawAxis(frame, self.mtx, self.dist, rvec, tvec, 0.1)
+                            if draw:
+                                aruco.drawDetectedMarkers(frame, corners, ids)
+                                aruco.drawAxis(frame, self.camera.K, self.camera.D, rvec, tvec, 0.1)
                            
                             (rvec - tvec).any()  # get rid of that nasty numpy value array error
                             
@@ -228,16 +245,20 @@ class MarkerDetector():
                             fly_pos.pose.position.y = tvec2[1][0] + self.local_pos[1]
                             fly_pos.pose.position.z = tvec2[2][0] + self.local_pos[2]
                             # publish marker in body frame
-                            str_position0 = "Marker Position: x=%f  y=%f  z=%f" % (fly_pos.pose.position.x, fly_pos.pose.position.y, fly_pos.pose.position.z)
-                            cv2.putText(frame, str_position0, (0, 50), self.font, 0.7, (0, 255, 0), 1, cv2.LINE_AA)
+                            if draw:
+                                str_position0 = "Marker Position: x=%f  y=%f  z=%f" % (fly_pos.pose.position.x, fly_pos.pose.position.y, fly_pos.pose.position.z)
+                                cv2.putText(frame, str_position0, (0, 50), self.font, 0.7, (0, 255, 0), 1, cv2.LINE_AA)
                             self.fly_pos_pub.publish(fly_pos)
                             self.rate.sleep()
             else:
                 ids_marker = False
                 self.check_marker_detection.publish(ids_marker)
 
-            cv2.imshow("frame", frame)
-            cv2.waitKey(1)
+            if draw and self.aruco_marker_img_pub.wanted():
+                self.aruco_marker_img_pub.publish(frame)
+            if self.show_window:
+                cv2.imshow("frame", frame)
+                cv2.waitKey(1)
 
 if __name__ == '__main__':
     MD = MarkerDetector()
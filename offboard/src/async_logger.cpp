@@ -0,0 +1,322 @@
+#include "offboard/async_logger.h"
+
+#include<algorithm>
+#include<cstring>
+
+namespace
+{
+
+/* copy one conversion spec of format starting at '%' into spec (flags, width and precision kept,
+   length modifiers dropped), returns the conversion character and advances format past it */
+char parseSpec(const char *&format, char *spec, size_t size) {
+    size_t n = 0;
+    spec[n++] = *format++;
+    while (*format != '\0' && std::strchr("-+ #0123456789.", *format) != nullptr) {
+        if (n + 4 < size) {
+            spec[n++] = *format;
+        }
+        format++;
+    }
+    while (*format != '\0' && std::strchr("hlLqjzt", *format) != nullptr) {
+        format++;
+    }
+    const char conversion = *format;
+    if (conversion != '\0') {
+        format++;
+    }
+    spec[n] = '\0';
+    return conversion;
+}
+
+void append(char *buffer, size_t size, size_t &length, int written) {
+    if (written > 0) {
+        length += static_cast<size_t>(written);
+    }
+    if (length >= size) {
+        length = size - 1;
+        buffer[length] = '\0';
+    }
+}
+
+} // namespace
+
+LogSite::LogSite(const char *format, double min_interval) : format(format),
+                                                            min_interval_ns(static_cast<int64_t>(min_interval * 1e9)),
+                                                            limited(0) {
+    for (std::atomic<int64_t> &next : next_ns) {
+        next.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool LogRing::push(const LogRecord &record) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= CAPACITY) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    records_[head & (CAPACITY - 1)] = record;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool LogRing::pop(LogRecord &record) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    record = records_[tail & (CAPACITY - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool LogRing::peek(int64_t &stamp_ns) const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    stamp_ns = records_[tail & (CAPACITY - 1)].stamp_ns;
+    return true;
+}
+
+int formatLogRecord(const LogRecord &record, char *buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    buffer[0] = '\0';
+    size_t length = 0;
+    int arg = 0;
+    const char *format = record.site->format;
+    while (*format != '\0' && length + 1 < size) {
+        if (*format != '%') {
+            buffer[length++] = *format++;
+            buffer[length] = '\0';
+            continue;
+        }
+        if (format[1] == '%') {
+            buffer[length++] = '%';
+            buffer[length] = '\0';
+            format += 2;
+            continue;
+        }
+        char spec[32];
+        const char conversion = parseSpec(format, spec, sizeof(spec));
+        if (conversion == '\0') {
+            break;
+        }
+        if (arg >= record.num_args || std::strchr("sp", conversion) != nullptr) {
+            // missing or unsupported (string, pointer) argument
+            append(buffer, size, length, std::snprintf(buffer + length, size - length, "?"));
+            continue;
+        }
+        const char type = record.types[arg];
+        const LogRecord::Arg value = record.args[arg++];
+        const size_t n = std::strlen(spec);
+        if (std::strchr("fFeEgGaA", conversion) != nullptr) {
+            spec[n] = conversion;
+            spec[n + 1] = '\0';
+            const double d = (type == 'd') ? value.d : (type == 'i') ? static_cast<double>(value.i) : static_cast<double>(value.u);
+            append(buffer, size, length, std::snprintf(buffer + length, size - length, spec, d));
+        }
+        else if (conversion == 'c') {
+            spec[n] = 'c';
+            spec[n + 1] = '\0';
+            const int c = (type == 'd') ? static_cast<int>(value.d) : static_cast<int>(value.i);
+            append(buffer, size, length, std::snprintf(buffer + length, size - length, spec, c));
+        }
+        else {
+            spec[n] = 'l';
+            spec[n + 1] = 'l';
+            spec[n + 2] = conversion;
+            spec[n + 3] = '\0';
+            if (conversion == 'd' || conversion == 'i') {
+                const long long i = (type == 'd') ? static_cast<long long>(value.d) : value.i;
+                append(buffer, size, length, std::snprintf(buffer + length, size - length, spec, i));
+            }
+            else {
+                const unsigned long long u = (type == 'd') ? static_cast<unsigned long long>(value.d) : value.u;
+                append(buffer, size, length, std::snprintf(buffer + length, size - length, spec, u));
+            }
+        }
+    }
+    return static_cast<int>(length);
+}
+
+AsyncLogger &AsyncLogger::instance() {
+    static AsyncLogger logger;
+    return logger;
+}
+
+AsyncLogger::~AsyncLogger() {
+    stop();
+}
+
+void AsyncLogger::start(const std::string &file, bool console, double period) {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    if (running_) {
+        return;
+    }
+    console_ = console;
+    period_ = (period > 0.0) ? period : 0.005;
+    if (!file.empty()) {
+        file_ = std::fopen(file.c_str(), "a");
+        if (file_ == nullptr) {
+            std::printf("[ WARN] Can not open log file %s\n", file.c_str());
+        }
+    }
+    running_ = true;
+    thread_ = std::thread(&AsyncLogger::run, this);
+}
+
+void AsyncLogger::stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    drain();
+    if (file_ != nullptr) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void AsyncLogger::registerThread() {
+    ring();
+}
+
+uint8_t AsyncLogger::registerSource(const std::string &name) {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    const std::string prefix = "[" + name + "] ";
+    const int count = num_sources_.load(std::memory_order_relaxed);
+    for (int k = 1; k < count; k++) {
+        if (sources_[k] == prefix) {
+            return static_cast<uint8_t>(k); // e.g. a nodelet loaded again
+        }
+    }
+    if (count >= LOG_MAX_SOURCES) {
+        return 0;
+    }
+    sources_[count] = prefix;
+    // the prefix is complete before the writer thread can see the new count
+    num_sources_.store(count + 1, std::memory_order_release);
+    return static_cast<uint8_t>(count);
+}
+
+uint64_t AsyncLogger::dropped() const {
+    uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (const std::unique_ptr<LogRing> &ring : rings_) {
+        dropped += ring->dropped();
+    }
+    return dropped;
+}
+
+int64_t AsyncLogger::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the ring is created on the first call of a thread, later calls only read a thread local pointer */
+LogRing *AsyncLogger::ring() {
+    thread_local LogRing *ring = nullptr;
+    if (ring == nullptr) {
+        std::unique_ptr<LogRing> created(new LogRing());
+        ring = created.get();
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::move(created));
+    }
+    return ring;
+}
+
+bool AsyncLogger::allow(LogSite &site, uint8_t source, int64_t now_ns) {
+    if (site.min_interval_ns <= 0) {
+        return true;
+    }
+    std::atomic<int64_t> &next_ns = site.next_ns[source % LOG_MAX_SOURCES];
+    int64_t next = next_ns.load(std::memory_order_relaxed);
+    if (now_ns >= next && next_ns.compare_exchange_strong(next, now_ns + site.min_interval_ns, std::memory_order_relaxed)) {
+        return true;
+    }
+    site.limited.fetch_add(1, std::memory_order_relaxed);
+    limited_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void AsyncLogger::enqueue(const LogRecord &record) {
+    if (running_.load(std::memory_order_acquire)) {
+        ring()->push(record);
+        return;
+    }
+    // no writer thread: behave like printf
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    write(record);
+    std::fflush(stdout);
+}
+
+/* writer thread: drain, report losses, sleep */
+void AsyncLogger::run() {
+    while (running_) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(period_));
+        }
+        const uint64_t lost = dropped();
+        if (lost > reported_dropped_) {
+            std::printf("[ WARN] Logger dropped %lu records (rings full)\n", static_cast<unsigned long>(lost - reported_dropped_));
+            reported_dropped_ = lost;
+        }
+    }
+}
+
+/* merge the rings by time stamp; bounded, so producers that keep logging can not starve the sleep */
+size_t AsyncLogger::drain() {
+    std::vector<LogRing *> rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings.reserve(rings_.size());
+        for (const std::unique_ptr<LogRing> &ring : rings_) {
+            rings.push_back(ring.get());
+        }
+    }
+    size_t count = 0;
+    LogRecord record;
+    while (count < LogRing::CAPACITY * rings.size()) {
+        LogRing *oldest = nullptr;
+        int64_t oldest_stamp = 0;
+        for (LogRing *ring : rings) {
+            int64_t stamp;
+            if (ring->peek(stamp) && (oldest == nullptr || stamp < oldest_stamp)) {
+                oldest = ring;
+                oldest_stamp = stamp;
+            }
+        }
+        if (oldest == nullptr || !oldest->pop(record)) {
+            break;
+        }
+        write(record);
+        count++;
+    }
+    if (count > 0) {
+        std::fflush(stdout);
+        if (file_ != nullptr) {
+            std::fflush(file_);
+        }
+    }
+    return count;
+}
+
+void AsyncLogger::write(const LogRecord &record) {
+    char text[512];
+    formatLogRecord(record, text, sizeof(text));
+    // the source prefix goes after the leading line breaks of the message
+    const char *prefix = (record.source > 0 && record.source < num_sources_.load(std::memory_order_acquire)) ? sources_[record.source].c_str() : "";
+    const size_t breaks = std::strspn(text, "\n");
+    char buffer[640];
+    int length = std::snprintf(buffer, sizeof(buffer), "%.*s%s%s", static_cast<int>(breaks), text, prefix, text + breaks);
+    length = std::min(std::max(length, 0), static_cast<int>(sizeof(buffer)) - 1);
+    if (console_) {
+        std::fwrite(buffer, 1, length, stdout);
+    }
+    if (file_ != nullptr) {
+        std::fwrite(buffer, 1, length, file_);
+    }
+    written_.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#include "offboard/control_law.h"
+
+#include<cmath>
+
+/* calculate components of velocity about x, y, z axis
+   input: desired velocity, current and target positions (ENU) */
+Eigen::Vector3d velocityTowards(double v_desired, const Eigen::Vector3d &current, const Eigen::Vector3d &target) {
+    Eigen::Vector3d delta = target - current;
+    double d = delta.norm();
+    if (d <= 0.0) {
+        return Eigen::Vector3d::Zero();
+    }
+    return (delta / d) * v_desired;
+}
+
+/* slow down for the last meters so the setpoint is reached without overshoot
+   input: distance to the setpoint, desired velocity of the leg */
+double legVelocity(double distance, double v_desired) {
+    return (distance < APPROACH_DISTANCE) ? APPROACH_VELOCITY : v_desired;
+}
+
+/* calculate yaw offset between current position and next optimization position */
+double bearingTo(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint) {
+    double alpha;
+    double xc = current.x();
+    double yc = current.y();
+    double xs = setpoint.x();
+    double ys = setpoint.y();
+
+    alpha = atan2(std::abs(ys - yc), std::abs(xs - xc));
+    if ((xs > xc) && (ys > yc)) {
+        return alpha;
+    }
+    else if ((xs < xc) && (ys > yc)) {
+        return (M_PI - alpha);
+    }
+    else if ((xs < xc) && (ys < yc)) {
+        return (alpha - M_PI);
+    }
+    else if ((xs > xc) && (ys < yc)) {
+        return (-alpha);
+    }
+    else if ((xs == xc) && (ys > yc)) {
+        return alpha;
+    }
+    else if ((xs == xc) && (ys < yc)) {
+        return (-alpha);
+    }
+    else if ((xs > xc) && (ys == yc)) {
+        return alpha;
+    }
+    else if ((xs < xc) && (ys == yc)) {
+        return (M_PI - alpha);
+    }
+    else {
+        return alpha;
+    }
+}
+
+/* test to know what direction drone need to spin */
+double unwrapYaw(double yaw, double target) {
+    if ((yaw - target) >= M_PI) {
+        target += 2*M_PI;
+    }
+    else if ((yaw - target) <= -M_PI) {
+        target -= 2*M_PI;
+    }
+    return target;
+}
+
+/* calculate the input for position controller so that the input yaw value will always be higher or lower than current yaw angle a value of yaw_rate
+   this make the drone yaw slower */
+double yawStep(double yaw, double target, double yaw_rate) {
+    if (target <= yaw) {
+        return ((yaw - target) > yaw_rate) ? yaw - yaw_rate : target;
+    }
+    return ((target - yaw) > yaw_rate) ? yaw + yaw_rate : target;
+}
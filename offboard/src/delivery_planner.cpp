@@ -0,0 +1,171 @@
+#include "offboard/delivery_planner.h"
+
+#include<algorithm>
+#include<limits>
+
+DeliveryPlanner::DeliveryPlanner(double budget_ms, int candidates) : budget_ms_(budget_ms),
+                                                                    candidates_(std::max(candidates, 1)) {
+}
+
+void DeliveryPlanner::rebuild(const DeliveryRoute &route) {
+    points_.clear();
+    nodes_.clear();
+    points_.reserve(route.size());
+    nodes_.reserve(route.size());
+    for (const DeliveryStop &stop : route) {
+        points_.push_back(stop.position);
+    }
+    std::vector<int> indexes(points_.size());
+    for (size_t k = 0; k < indexes.size(); k++) {
+        indexes[k] = static_cast<int>(k);
+    }
+    root_ = build(indexes, 0, static_cast<int>(indexes.size()), 0);
+}
+
+int DeliveryPlanner::build(std::vector<int> &indexes, int begin, int end, int depth) {
+    if (begin >= end) {
+        return -1;
+    }
+    const int axis = depth % 3;
+    const int middle = (begin + end) / 2;
+    std::nth_element(indexes.begin() + begin, indexes.begin() + middle, indexes.begin() + end,
+                     [&](int l, int r) { return points_[l][axis] < points_[r][axis]; });
+    Node node;
+    node.index = indexes[middle];
+    node.axis = axis;
+    const int id = static_cast<int>(nodes_.size());
+    nodes_.push_back(node);
+    const int left = build(indexes, begin, middle, depth + 1);
+    const int right = build(indexes, middle + 1, end, depth + 1);
+    nodes_[id].left = left;
+    nodes_[id].right = right;
+    return id;
+}
+
+/* best keeps the k nearest (squared distance, index) pairs as a max-heap */
+void DeliveryPlanner::nearest(int node, const Eigen::Vector3d &query, int k, std::vector<std::pair<double, int>> &best) const {
+    if (node < 0) {
+        return;
+    }
+    const Node &n = nodes_[node];
+    const double d2 = (points_[n.index] - query).squaredNorm();
+    if (static_cast<int>(best.size()) < k) {
+        best.emplace_back(d2, n.index);
+        std::push_heap(best.begin(), best.end());
+    }
+    else if (d2 < best.front().first) {
+        std::pop_heap(best.begin(), best.end());
+        best.back() = std::make_pair(d2, n.index);
+        std::push_heap(best.begin(), best.end());
+    }
+    const double diff = query[n.axis] - points_[n.index][n.axis];
+    const int near = (diff < 0.0) ? n.left : n.right;
+    const int far = (diff < 0.0) ? n.right : n.left;
+    nearest(near, query, k, best);
+    if (static_cast<int>(best.size()) < k || diff * diff < best.front().first) {
+        nearest(far, query, k, best);
+    }
+}
+
+int DeliveryPlanner::insert(const Eigen::Vector3d &start, DeliveryRoute &route, const DeliveryStop &stop, int first_fixed) {
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds(static_cast<long>(budget_ms_ * 1e3));
+    const int n = static_cast<int>(route.size());
+    if (n == 0) {
+        route.push_back(stop);
+        rebuild(route);
+        return 0;
+    }
+    const int first = std::min(std::max(first_fixed, 0), n - 1);
+
+    // insertion position k puts the stop between (k == 0 ? start : route[k - 1]) and route[k], first <= k < n keeps the fixed stops in place
+    std::vector<int> positions(1, first);
+    if (static_cast<int>(points_.size()) == n) {
+        std::vector<std::pair<double, int>> best;
+        best.reserve(candidates_);
+        nearest(root_, stop.position, candidates_, best);
+        for (const std::pair<double, int> &b : best) {
+            if (b.second >= first) {
+                positions.push_back(b.second);
+            }
+            if (b.second + 1 < n && b.second + 1 >= first) {
+                positions.push_back(b.second + 1);
+            }
+        }
+    }
+    else {
+        // tree out of date, try every edge
+        for (int k = first + 1; k < n; k++) {
+            positions.push_back(k);
+        }
+    }
+    int best_position = n - 1;
+    double best_cost = std::numeric_limits<double>::max();
+    for (int k : positions) {
+        const Eigen::Vector3d &prev = (k == 0) ? start : route[k - 1].position;
+        const Eigen::Vector3d &next = route[k].position;
+        const double cost = (prev - stop.position).norm() + (stop.position - next).norm() - (prev - next).norm();
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_position = k;
+        }
+    }
+    route.insert(route.begin() + best_position, stop);
+
+    twoOpt(start, route, first, deadline);
+    rebuild(route);
+    for (size_t k = 0; k < route.size(); k++) {
+        if (route[k].id == stop.id) {
+            return static_cast<int>(k);
+        }
+    }
+    return best_position;
+}
+
+/* reverse route[a..b] (a >= first) while it shortens the route, the last stop never moves */
+bool DeliveryPlanner::twoOpt(const Eigen::Vector3d &start, DeliveryRoute &route, int first, std::chrono::steady_clock::time_point deadline) const {
+    const int n = static_cast<int>(route.size());
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (int a = first; a < n - 2; a++) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            const Eigen::Vector3d &prev = (a == 0) ? start : route[a - 1].position;
+            for (int b = a + 1; b < n - 1; b++) {
+                const Eigen::Vector3d &next = route[b + 1].position;
+                const double delta = (prev - route[b].position).norm() + (route[a].position - next).norm() -
+                                     (prev - route[a].position).norm() - (route[b].position - next).norm();
+                if (delta < -1e-9) {
+                    std::reverse(route.begin() + a, route.begin() + b + 1);
+                    improved = true;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool DeliveryPlanner::cancel(DeliveryRoute &route, int id, int first_fixed) {
+    for (size_t k = static_cast<size_t>(std::max(first_fixed, 0)); k + 1 < route.size(); k++) {
+        if (route[k].id == id) {
+            route.erase(route.begin() + k);
+            rebuild(route);
+            return true;
+        }
+    }
+    return false;
+}
+
+void DeliveryPlanner::etas(const Eigen::Vector3d &start, const DeliveryRoute &route, double velocity, double service_time, std::vector<double> &eta) const {
+    eta.resize(route.size());
+    double t = 0.0;
+    Eigen::Vector3d prev = start;
+    for (size_t k = 0; k < route.size(); k++) {
+        t += (route[k].position - prev).norm() / std::max(velocity, 1e-3);
+        eta[k] = t;
+        t += service_time;
+        prev = route[k].position;
+    }
+}
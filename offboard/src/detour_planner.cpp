@@ -0,0 +1,84 @@
+#include "offboard/detour_planner.h"
+#include "offboard/realtime.h"
+
+#include<chrono>
+
+DetourPlanner::DetourPlanner(const SpatialMap &map) : map_(map) {
+}
+
+DetourPlanner::~DetourPlanner() {
+    stop();
+}
+
+void DetourPlanner::start() {
+    stop();
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = true;
+    thread_ = std::thread(&DetourPlanner::run, this);
+}
+
+void DetourPlanner::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void DetourPlanner::request(const Eigen::Vector3d &start, const Eigen::Vector3d &goal) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_ = start;
+        goal_ = goal;
+        requested_++;
+    }
+    wake_.notify_one();
+}
+
+/* copy the detour of the newest request once it is planned
+   output: waypoints (the last one is the goal), whether a detour was found and the search time (ms) */
+bool DetourPlanner::result(std::vector<Eigen::Vector3d> &waypoints, bool &found, double &planning_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (planned_ != requested_ || taken_ == planned_) {
+        return false;
+    }
+    taken_ = planned_;
+    found = found_;
+    planning_ms = planning_ms_;
+    waypoints.assign(waypoints_.begin(), waypoints_.end());
+    return true;
+}
+
+void DetourPlanner::run() {
+    // started after the mission thread entered real-time, whose SCHED_FIFO priority and CPU are inherited
+    leaveRealtime();
+    std::vector<Eigen::Vector3d> waypoints;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return !running_ || started_ != requested_; });
+        if (!running_) {
+            break;
+        }
+        const uint64_t id = requested_;
+        const Eigen::Vector3d start = start_;
+        const Eigen::Vector3d goal = goal_;
+        started_ = id;
+        lock.unlock();
+
+        const std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+        const bool found = map_.planDetour(start, goal, waypoints);
+        const double planning_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+        lock.lock();
+        // a request posted during the search replaced this one: its result is dropped, the new one is planned
+        if (id == requested_) {
+            planned_ = id;
+            found_ = found;
+            planning_ms_ = planning_ms;
+            waypoints_.swap(waypoints);
+        }
+    }
+}
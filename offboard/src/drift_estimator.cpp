@@ -0,0 +1,215 @@
+#include "offboard/drift_estimator.h"
+#include "offboard/realtime.h"
+
+#include<algorithm>
+#include<cmath>
+#include<cstdio>
+
+namespace
+{
+
+const double WGS84_A = 6378137.0; // semimajor axis (m)
+const double WGS84_B = 6356752.314245; // semiminor axis (m)
+const double WGS84_F = (WGS84_A - WGS84_B) / WGS84_A; // flattening
+const double WGS84_E_SQ = WGS84_F * (2 - WGS84_F); // square of eccentricity
+
+Eigen::Vector3d geodeticToECEF(double latitude, double longitude, double altitude) {
+    const double lambda = latitude * M_PI / 180.0;
+    const double phi = longitude * M_PI / 180.0;
+    const double s = std::sin(lambda);
+    const double N = WGS84_A / std::sqrt(1 - WGS84_E_SQ * s * s);
+    return Eigen::Vector3d((altitude + N) * std::cos(lambda) * std::cos(phi),
+                           (altitude + N) * std::cos(lambda) * std::sin(phi),
+                           (altitude + (1 - WGS84_E_SQ) * N) * s);
+}
+
+double stampOf(const ros::Time &stamp) {
+    return stamp.isZero() ? ros::Time::now().toSec() : stamp.toSec();
+}
+
+} // namespace
+
+void Vector3Snapshot::store(const Eigen::Vector3d &value) {
+    const unsigned sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int k = 0; k < 3; k++) {
+        data_[k].store(value[k], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+Eigen::Vector3d Vector3Snapshot::load() const {
+    Eigen::Vector3d value;
+    unsigned before, after;
+    do {
+        before = sequence_.load(std::memory_order_acquire);
+        for (int k = 0; k < 3; k++) {
+            value[k] = data_[k].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1u) != 0 || before != after);
+    return value;
+}
+
+DriftEstimator::DriftEstimator(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private) : nh_(nh),
+                                                                                             nh_private_(nh_private) {
+    nh_.setCallbackQueue(&callback_queue_);
+    nh_private_.setCallbackQueue(&callback_queue_);
+
+    nh_private_.param<bool>("drift_enable", enable_, true);
+    nh_private_.param<double>("drift_process_noise", process_noise_, 0.02);
+    nh_private_.param<double>("drift_gps_sigma_h", gps_sigma_h_, 1.5);
+    nh_private_.param<double>("drift_gps_sigma_v", gps_sigma_v_, 3.0);
+    nh_private_.param<double>("drift_initial_sigma", initial_sigma_, 0.3);
+    nh_private_.param<double>("drift_gate", gate_, 11.34); // chi-square 99%, 3 dof
+    nh_private_.param<int>("drift_max_rejected", max_rejected_, 20);
+    nh_private_.param<double>("drift_max", drift_max_, 10.0);
+    nh_private_.param<double>("drift_max_vertical", drift_max_vertical_, 0.5);
+
+    offset_.store(Eigen::Vector3d::Zero());
+    drift_.store(Eigen::Vector3d::Zero());
+}
+
+DriftEstimator::~DriftEstimator() {
+    stop();
+}
+
+void DriftEstimator::start(const sensor_msgs::NavSatFix &ref, const Eigen::Vector3d &offset) {
+    stop();
+    // the reference is constant for the mission: its ECEF position and rotation are computed once
+    const double lambda = ref.latitude * M_PI / 180.0;
+    const double phi = ref.longitude * M_PI / 180.0;
+    ref_ecef_ = geodeticToECEF(ref.latitude, ref.longitude, ref.altitude);
+    ecef_to_enu_ << -std::sin(phi), std::cos(phi), 0.0,
+                    -std::cos(phi) * std::sin(lambda), -std::sin(lambda) * std::sin(phi), std::cos(lambda),
+                    std::cos(lambda) * std::cos(phi), std::cos(lambda) * std::sin(phi), std::sin(lambda);
+    initial_offset_ = state_ = offset;
+    covariance_ = Eigen::Matrix3d::Identity() * initial_sigma_ * initial_sigma_;
+    last_update_ = ros::Time::now().toSec();
+    rejected_in_row_ = 0;
+    odom_count_ = odom_next_ = 0;
+    publish();
+    if (!enable_) {
+        return;
+    }
+    odom_sub_ = nh_.subscribe("mavros/local_position/odom", 10, &DriftEstimator::odomCallback, this);
+    gps_sub_ = nh_.subscribe("mavros/global_position/global", 10, &DriftEstimator::gpsCallback, this);
+    running_ = true;
+    thread_ = std::thread(&DriftEstimator::run, this);
+}
+
+void DriftEstimator::stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    odom_sub_.shutdown();
+    gps_sub_.shutdown();
+}
+
+void DriftEstimator::run() {
+    // started after the mission thread entered real-time, whose SCHED_FIFO priority and CPU are inherited
+    leaveRealtime();
+    while (running_ && ros::ok()) {
+        callback_queue_.callAvailable(ros::WallDuration(0.05));
+    }
+}
+
+Eigen::Vector3d DriftEstimator::toENU(const sensor_msgs::NavSatFix &fix) const {
+    return ecef_to_enu_ * (geodeticToECEF(fix.latitude, fix.longitude, fix.altitude) - ref_ecef_);
+}
+
+/* GPS fixes arrive later than the odometry of the same instant, the odometry is interpolated at the fix stamp */
+bool DriftEstimator::odomAt(double stamp, Eigen::Vector3d &position) const {
+    if (odom_count_ == 0) {
+        return false;
+    }
+    const int newest = (odom_next_ + ODOM_HISTORY - 1) % ODOM_HISTORY;
+    const int oldest = (odom_count_ < ODOM_HISTORY) ? 0 : odom_next_;
+    if (stamp >= odom_history_[newest].stamp) {
+        position = odom_history_[newest].position;
+        return true;
+    }
+    if (stamp <= odom_history_[oldest].stamp) {
+        position = odom_history_[oldest].position;
+        return true;
+    }
+    for (int k = 1; k < odom_count_; k++) {
+        const OdomSample &before = odom_history_[(newest + ODOM_HISTORY - k) % ODOM_HISTORY];
+        if (before.stamp <= stamp) {
+            const OdomSample &after = odom_history_[(newest + ODOM_HISTORY - k + 1) % ODOM_HISTORY];
+            const double span = after.stamp - before.stamp;
+            const double t = (span > 0.0) ? (stamp - before.stamp) / span : 1.0;
+            position = before.position + t * (after.position - before.position);
+            return true;
+        }
+    }
+    position = odom_history_[oldest].position;
+    return true;
+}
+
+void DriftEstimator::publish() {
+    offset_.store(state_);
+    Eigen::Vector3d drift = state_ - initial_offset_;
+    const double horizontal = drift.head<2>().norm();
+    if (horizontal > drift_max_) {
+        drift.head<2>() *= drift_max_ / horizontal;
+    }
+    drift.z() = std::max(-drift_max_vertical_, std::min(drift.z(), drift_max_vertical_));
+    drift_.store(drift);
+}
+
+void DriftEstimator::odomCallback(const nav_msgs::Odometry::ConstPtr &msg) {
+    OdomSample &sample = odom_history_[odom_next_];
+    sample.stamp = stampOf(msg->header.stamp);
+    sample.position << msg->pose.pose.position.x, msg->pose.pose.position.y, msg->pose.pose.position.z;
+    odom_next_ = (odom_next_ + 1) % ODOM_HISTORY;
+    odom_count_ = std::min(odom_count_ + 1, static_cast<int>(ODOM_HISTORY));
+}
+
+void DriftEstimator::gpsCallback(const sensor_msgs::NavSatFix::ConstPtr &msg) {
+    const double stamp = stampOf(msg->header.stamp);
+    Eigen::Vector3d odom;
+    if (msg->status.status < sensor_msgs::NavSatStatus::STATUS_FIX || !odomAt(stamp, odom)) {
+        return;
+    }
+    const Eigen::Vector3d measurement = odom - toENU(*msg);
+
+    // predict: the offset is a random walk
+    const double dt = std::max(stamp - last_update_, 0.0);
+    covariance_ += Eigen::Matrix3d::Identity() * process_noise_ * process_noise_ * dt;
+
+    // update: the offset is measured directly (H = I)
+    Eigen::Matrix3d noise = Eigen::Matrix3d::Zero();
+    if (msg->position_covariance_type != sensor_msgs::NavSatFix::COVARIANCE_TYPE_UNKNOWN) {
+        for (int k = 0; k < 3; k++) {
+            noise(k, k) = std::max(msg->position_covariance[4 * k], 1e-4);
+        }
+    }
+    else {
+        noise.diagonal() << gps_sigma_h_ * gps_sigma_h_, gps_sigma_h_ * gps_sigma_h_, gps_sigma_v_ * gps_sigma_v_;
+    }
+    const Eigen::Vector3d innovation = measurement - state_;
+    const Eigen::Matrix3d innovation_covariance = covariance_ + noise;
+    if (innovation.dot(innovation_covariance.ldlt().solve(innovation)) > gate_) {
+        rejected_++;
+        if (++rejected_in_row_ < max_rejected_) {
+            return;
+        }
+        // the measurements consistently disagree (odometry reset, re-initialized EKF2 origin): start over from them
+        std::printf("\n[ WARN] Drift estimator re-initialized, offset jumped by %.1f (m)\n", innovation.norm());
+        state_ = measurement;
+        covariance_ = noise;
+    }
+    else {
+        const Eigen::Matrix3d gain = covariance_ * innovation_covariance.inverse();
+        state_ += gain * innovation;
+        covariance_ = (Eigen::Matrix3d::Identity() - gain) * covariance_;
+        updates_++;
+    }
+    rejected_in_row_ = 0;
+    last_update_ = stamp;
+    publish();
+}
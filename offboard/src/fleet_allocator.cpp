@@ -0,0 +1,308 @@
+#include "offboard/fleet_allocator.h"
+
+#include<algorithm>
+#include<atomic>
+#include<functional>
+#include<limits>
+#include<thread>
+
+namespace
+{
+
+/* run task(0..count-1) on up to num_threads threads, tasks are taken from a shared counter */
+void parallelFor(int count, int num_threads, const std::function<void(int)> &task) {
+    int workers = std::max(1, std::min(num_threads, count));
+    if (workers == 1) {
+        for (int i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    threads.reserve(workers);
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            for (int i = next++; i < count; i = next++) {
+                task(i);
+            }
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+} // namespace
+
+FleetAllocator::FleetAllocator(double velocity, double service_time, int num_threads) : velocity_(velocity),
+                                                                                         service_time_(service_time),
+                                                                                         num_threads_(num_threads) {
+    if (num_threads_ <= 0) {
+        num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+/* allocate deliveries to vehicles
+   input: vehicles (home and limits) and deliveries (position and payload) */
+FleetAssignment FleetAllocator::solve(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries) const {
+    FleetAssignment assignment;
+    assignment.routes.resize(vehicles.size());
+    assignment.route_time.assign(vehicles.size(), 0.0);
+    if (vehicles.empty()) {
+        for (int d = 0; d < static_cast<int>(deliveries.size()); d++) {
+            assignment.unassigned.push_back(d);
+        }
+        return assignment;
+    }
+
+    insertDeliveries(vehicles, deliveries, assignment);
+    improveRoutes(vehicles, deliveries, assignment);
+
+    assignment.makespan = 0.0;
+    for (int v = 0; v < static_cast<int>(vehicles.size()); v++) {
+        assignment.route_time[v] = routeTime(vehicles, deliveries, v, assignment.routes[v]);
+        assignment.makespan = std::max(assignment.makespan, assignment.route_time[v]);
+    }
+    return assignment;
+}
+
+double FleetAllocator::routeLength(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const {
+    if (route.empty()) {
+        return 0.0;
+    }
+    const Eigen::Vector3d &home = vehicles[vehicle].home;
+    double length = (deliveries[route.front()].position - home).norm();
+    for (size_t k = 1; k < route.size(); k++) {
+        length += (deliveries[route[k]].position - deliveries[route[k - 1]].position).norm();
+    }
+    length += (home - deliveries[route.back()].position).norm();
+    return length;
+}
+
+double FleetAllocator::routeTime(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const {
+    return routeLength(vehicles, deliveries, vehicle, route) / velocity_ + service_time_ * route.size();
+}
+
+bool FleetAllocator::feasible(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, const std::vector<int> &route) const {
+    const FleetVehicle &v = vehicles[vehicle];
+    if (v.max_payload > 0.0) {
+        double payload = 0.0;
+        for (int d : route) {
+            payload += deliveries[d].payload;
+        }
+        if (payload > v.max_payload) {
+            return false;
+        }
+    }
+    if (v.max_range > 0.0 && routeLength(vehicles, deliveries, vehicle, route) > v.max_range) {
+        return false;
+    }
+    return true;
+}
+
+bool FleetAllocator::better(double makespan, double total, double best_makespan, double best_total) const {
+    const double eps = 1e-9;
+    if (makespan < best_makespan - eps) {
+        return true;
+    }
+    return (makespan <= best_makespan + eps) && (total < best_total - eps);
+}
+
+/* build the initial routes: farthest deliveries first, each inserted where the makespan grows least */
+void FleetAllocator::insertDeliveries(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, FleetAssignment &assignment) const {
+    const int num_vehicles = vehicles.size();
+    std::vector<double> nearest_home(deliveries.size(), std::numeric_limits<double>::max());
+    std::vector<int> order(deliveries.size());
+    for (int d = 0; d < static_cast<int>(deliveries.size()); d++) {
+        order[d] = d;
+        for (const FleetVehicle &v : vehicles) {
+            nearest_home[d] = std::min(nearest_home[d], (deliveries[d].position - v.home).norm());
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int l, int r) { return nearest_home[l] > nearest_home[r]; });
+
+    std::vector<double> times(num_vehicles, 0.0);
+    std::vector<int> candidate;
+    for (int d : order) {
+        int best_vehicle = -1, best_pos = -1;
+        double best_makespan = std::numeric_limits<double>::max(), best_total = std::numeric_limits<double>::max();
+        double total = 0.0;
+        for (double t : times) {
+            total += t;
+        }
+        for (int v = 0; v < num_vehicles; v++) {
+            const std::vector<int> &route = assignment.routes[v];
+            for (int pos = 0; pos <= static_cast<int>(route.size()); pos++) {
+                candidate = route;
+                candidate.insert(candidate.begin() + pos, d);
+                if (!feasible(vehicles, deliveries, v, candidate)) {
+                    continue;
+                }
+                double t = routeTime(vehicles, deliveries, v, candidate);
+                double makespan = t;
+                for (int u = 0; u < num_vehicles; u++) {
+                    if (u != v) {
+                        makespan = std::max(makespan, times[u]);
+                    }
+                }
+                double new_total = total - times[v] + t;
+                if (better(makespan, new_total, best_makespan, best_total)) {
+                    best_makespan = makespan;
+                    best_total = new_total;
+                    best_vehicle = v;
+                    best_pos = pos;
+                }
+            }
+        }
+        if (best_vehicle < 0) {
+            assignment.unassigned.push_back(d);
+            continue;
+        }
+        std::vector<int> &route = assignment.routes[best_vehicle];
+        route.insert(route.begin() + best_pos, d);
+        times[best_vehicle] = routeTime(vehicles, deliveries, best_vehicle, route);
+    }
+}
+
+/* improve a single route with 2-opt segment reversals (first improvement) */
+void FleetAllocator::twoOpt(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, int vehicle, std::vector<int> &route) const {
+    const int n = route.size();
+    bool improved = true;
+    double best = routeLength(vehicles, deliveries, vehicle, route);
+    while (improved) {
+        improved = false;
+        for (int i = 0; i < n - 1 && !improved; i++) {
+            for (int j = i + 1; j < n && !improved; j++) {
+                std::reverse(route.begin() + i, route.begin() + j + 1);
+                double length = routeLength(vehicles, deliveries, vehicle, route);
+                if (length < best - 1e-9) {
+                    best = length;
+                    improved = true;
+                }
+                else {
+                    std::reverse(route.begin() + i, route.begin() + j + 1);
+                }
+            }
+        }
+    }
+}
+
+/* best relocate or swap move that changes route to_route, evaluated against all other routes */
+FleetAllocator::Move FleetAllocator::bestMoveTo(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, const FleetAssignment &assignment, int to_route) const {
+    const int num_vehicles = vehicles.size();
+    const std::vector<double> &times = assignment.route_time;
+    double makespan_now = 0.0, total_now = 0.0;
+    for (double t : times) {
+        makespan_now = std::max(makespan_now, t);
+        total_now += t;
+    }
+
+    Move best;
+    best.makespan = makespan_now;
+    best.total = total_now;
+    std::vector<int> from, to;
+    const std::vector<int> &target = assignment.routes[to_route];
+    for (int a = 0; a < num_vehicles; a++) {
+        if (a == to_route) {
+            continue;
+        }
+        double others = 0.0;
+        for (int u = 0; u < num_vehicles; u++) {
+            if (u != a && u != to_route) {
+                others = std::max(others, times[u]);
+            }
+        }
+        const std::vector<int> &source = assignment.routes[a];
+        for (int p = 0; p < static_cast<int>(source.size()); p++) {
+            // relocate source[p] into target at every position
+            from = source;
+            from.erase(from.begin() + p);
+            if (!feasible(vehicles, deliveries, a, from)) {
+                continue;
+            }
+            double time_from = routeTime(vehicles, deliveries, a, from);
+            for (int q = 0; q <= static_cast<int>(target.size()); q++) {
+                to = target;
+                to.insert(to.begin() + q, source[p]);
+                if (!feasible(vehicles, deliveries, to_route, to)) {
+                    continue;
+                }
+                double time_to = routeTime(vehicles, deliveries, to_route, to);
+                double makespan = std::max(others, std::max(time_from, time_to));
+                double total = total_now - times[a] - times[to_route] + time_from + time_to;
+                if (better(makespan, total, best.makespan, best.total)) {
+                    best.type = 1;
+                    best.from_route = a;
+                    best.from_pos = p;
+                    best.to_route = to_route;
+                    best.to_pos = q;
+                    best.makespan = makespan;
+                    best.total = total;
+                }
+            }
+            // swap source[p] with each target[q]
+            for (int q = 0; q < static_cast<int>(target.size()); q++) {
+                from = source;
+                to = target;
+                std::swap(from[p], to[q]);
+                if (!feasible(vehicles, deliveries, a, from) || !feasible(vehicles, deliveries, to_route, to)) {
+                    continue;
+                }
+                double time_from = routeTime(vehicles, deliveries, a, from);
+                double time_to = routeTime(vehicles, deliveries, to_route, to);
+                double makespan = std::max(others, std::max(time_from, time_to));
+                double total = total_now - times[a] - times[to_route] + time_from + time_to;
+                if (better(makespan, total, best.makespan, best.total)) {
+                    best.type = 2;
+                    best.from_route = a;
+                    best.from_pos = p;
+                    best.to_route = to_route;
+                    best.to_pos = q;
+                    best.makespan = makespan;
+                    best.total = total;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/* local search: reorder every route, then apply the best inter-route move until none improves */
+void FleetAllocator::improveRoutes(const std::vector<FleetVehicle> &vehicles, const std::vector<FleetDelivery> &deliveries, FleetAssignment &assignment) const {
+    const int num_vehicles = vehicles.size();
+    std::vector<Move> moves(num_vehicles);
+    for (int iteration = 0; iteration < max_iterations_; iteration++) {
+        parallelFor(num_vehicles, num_threads_, [&](int v) {
+            twoOpt(vehicles, deliveries, v, assignment.routes[v]);
+            assignment.route_time[v] = routeTime(vehicles, deliveries, v, assignment.routes[v]);
+        });
+
+        parallelFor(num_vehicles, num_threads_, [&](int b) {
+            moves[b] = bestMoveTo(vehicles, deliveries, assignment, b);
+        });
+
+        const Move *best = nullptr;
+        for (const Move &m : moves) {
+            if (m.type != 0 && (best == nullptr || better(m.makespan, m.total, best->makespan, best->total))) {
+                best = &m;
+            }
+        }
+        if (best == nullptr) {
+            break;
+        }
+
+        std::vector<int> &from = assignment.routes[best->from_route];
+        std::vector<int> &to = assignment.routes[best->to_route];
+        if (best->type == 1) {
+            int d = from[best->from_pos];
+            from.erase(from.begin() + best->from_pos);
+            to.insert(to.begin() + best->to_pos, d);
+        }
+        else {
+            std::swap(from[best->from_pos], to[best->to_pos]);
+        }
+        assignment.route_time[best->from_route] = routeTime(vehicles, deliveries, best->from_route, from);
+        assignment.route_time[best->to_route] = routeTime(vehicles, deliveries, best->to_route, to);
+    }
+}
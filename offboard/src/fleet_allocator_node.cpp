@@ -0,0 +1,112 @@
+#include<ros/ros.h>
+#include<offboard/AllocateDeliveries.h>
+
+#include"offboard/fleet_allocator.h"
+
+#include<cstdio>
+#include<string>
+#include<vector>
+
+/* fleet-level service: splits a batch of deliveries over several vehicles and
+   writes each vehicle its ordered ENU setpoints (number_of_target, target_*_pos) */
+class FleetAllocatorServer
+{
+  public:
+	FleetAllocatorServer(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private);
+  private:
+	ros::NodeHandle nh_;
+	ros::NodeHandle nh_private_;
+	ros::ServiceServer allocate_server_; // allocate_deliveries service
+
+	double cruise_altitude_; // altitude of every delivery setpoint (m)
+	double velocity_; // cruise velocity of the vehicles (m/s)
+	double service_time_; // time spent at each drop: descent, unpack and climb (s)
+	int num_threads_; // local search threads, <= 0 for all cores
+	std::string controller_name_; // name of the offboard controller inside each vehicle namespace
+
+	bool allocateCallback(offboard::AllocateDeliveries::Request &req, offboard::AllocateDeliveries::Response &res); // allocate and push waypoints
+	void pushRoute(const std::string &ns, const Eigen::Vector3d &home, const std::vector<FleetDelivery> &deliveries, const std::vector<int> &route); // write the route of one vehicle
+};
+
+FleetAllocatorServer::FleetAllocatorServer(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private) : nh_(nh),
+                                                                                                          nh_private_(nh_private) {
+    nh_private_.param<double>("cruise_altitude", cruise_altitude_, 5.0);
+    nh_private_.param<double>("desired_velocity", velocity_, 0.7);
+    nh_private_.param<double>("service_time", service_time_, 30.0);
+    nh_private_.param<int>("num_threads", num_threads_, 0);
+    nh_private_.param<std::string>("controller_name", controller_name_, "offboard");
+
+    allocate_server_ = nh_.advertiseService("allocate_deliveries", &FleetAllocatorServer::allocateCallback, this);
+    std::printf("[ INFO] Fleet allocator ready\n");
+}
+
+bool FleetAllocatorServer::allocateCallback(offboard::AllocateDeliveries::Request &req, offboard::AllocateDeliveries::Response &res) {
+    const size_t num_vehicles = req.vehicle_namespaces.size();
+    if (req.vehicle_homes.size() != num_vehicles) {
+        res.success = false;
+        res.message = "vehicle_namespaces and vehicle_homes must have the same size";
+        return true;
+    }
+
+    std::vector<FleetVehicle> vehicles(num_vehicles);
+    for (size_t v = 0; v < num_vehicles; v++) {
+        vehicles[v].home = Eigen::Vector3d(req.vehicle_homes[v].x, req.vehicle_homes[v].y, cruise_altitude_);
+        vehicles[v].max_range = (v < req.max_range.size()) ? req.max_range[v] : 0.0;
+        vehicles[v].max_payload = (v < req.max_payload.size()) ? req.max_payload[v] : 0.0;
+    }
+    std::vector<FleetDelivery> deliveries(req.deliveries.size());
+    for (size_t d = 0; d < req.deliveries.size(); d++) {
+        deliveries[d].position = Eigen::Vector3d(req.deliveries[d].x, req.deliveries[d].y, cruise_altitude_);
+        deliveries[d].payload = (d < req.payloads.size()) ? req.payloads[d] : 0.0;
+    }
+
+    ros::WallTime t_start = ros::WallTime::now();
+    FleetAllocator allocator(velocity_, service_time_, num_threads_);
+    FleetAssignment assignment = allocator.solve(vehicles, deliveries);
+    std::printf("\n[ INFO] Allocated %zu deliveries to %zu vehicles in %.1f (ms), makespan %.1f (s)\n", deliveries.size(), num_vehicles, (ros::WallTime::now() - t_start).toSec() * 1e3, assignment.makespan);
+
+    res.assigned_vehicle.assign(deliveries.size(), -1);
+    for (size_t v = 0; v < num_vehicles; v++) {
+        for (int d : assignment.routes[v]) {
+            res.assigned_vehicle[d] = v;
+        }
+        std::printf(" %s: %zu deliveries, %.1f (s)\n", req.vehicle_namespaces[v].c_str(), assignment.routes[v].size(), assignment.route_time[v]);
+        pushRoute(req.vehicle_namespaces[v], vehicles[v].home, deliveries, assignment.routes[v]);
+    }
+    res.route_time = assignment.route_time;
+    res.makespan = assignment.makespan;
+    res.success = assignment.unassigned.empty();
+    res.message = res.success ? "all deliveries assigned" : std::to_string(assignment.unassigned.size()) + " deliveries exceed every vehicle's range or payload";
+    return true;
+}
+
+/* write the ordered drops of one vehicle in its own local ENU frame (origin at its home)
+   every target is a drop, so return home is enabled for the last one. A vehicle without drops
+   gets number_of_target 0 (it stays on the ground) so it does not fly an older route */
+void FleetAllocatorServer::pushRoute(const std::string &ns, const Eigen::Vector3d &home, const std::vector<FleetDelivery> &deliveries, const std::vector<int> &route) {
+    std::vector<double> x, y, z;
+    for (int d : route) {
+        x.push_back(deliveries[d].position.x() - home.x());
+        y.push_back(deliveries[d].position.y() - home.y());
+        z.push_back(cruise_altitude_);
+    }
+    const std::string prefix = ns + "/" + controller_name_ + "/";
+    nh_.setParam(prefix + "number_of_target", static_cast<int>(route.size()));
+    nh_.setParam(prefix + "target_x_pos", x);
+    nh_.setParam(prefix + "target_y_pos", y);
+    nh_.setParam(prefix + "target_z_pos", z);
+    nh_.setParam(prefix + "delivery_mode_enable", true);
+    nh_.setParam(prefix + "return_home_mode_enable", true);
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "fleet_allocator");
+    ros::NodeHandle nh;
+    ros::NodeHandle nh_private("~");
+
+    FleetAllocatorServer server(nh, nh_private);
+    ros::spin();
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "offboard/flight_tick.h"
+#include "offboard/async_logger.h"
+#include "offboard/control_law.h"
+
+#include<cmath>
+
+LegGuard::LegGuard(const SpatialMap &map) : map_(map),
+                                            planner_(map) {
+}
+
+void LegGuard::configure(bool enable, double detour_error, uint8_t log_source, double log_period) {
+    enable_ = enable;
+    detour_error_ = detour_error;
+    log_source_ = log_source;
+    log_period_ = log_period;
+}
+
+void LegGuard::reset(const Eigen::Vector3d &current) {
+    valid_ = false;
+    blocked_ = false;
+    planning_ = false;
+    replan_ticks_ = 0;
+    detour_.clear();
+    hold_ = current;
+}
+
+/* check the straight leg to a setpoint against the map, a blocked one is planned by planner_
+   (A* may take seconds, the loop holds position and keeps publishing meanwhile)
+   input: start and setpoint positions (ENU), output: false while there is no safe path to fly */
+bool LegGuard::plan(const Eigen::Vector3d &start, const Eigen::Vector3d &setpoint) {
+    detour_.clear();
+    planning_ = false;
+    if (map_.segmentFree(start, setpoint)) {
+        return true;
+    }
+    planner_.request(start, setpoint);
+    planning_ = true;
+    return false;
+}
+
+void LegGuard::takeDetour() {
+    bool found;
+    double planning_ms;
+    if (!planner_.result(detour_, found, planning_ms)) {
+        return;
+    }
+    planning_ = false;
+    if (found) {
+        detour_.pop_back(); // the last waypoint is the setpoint itself
+        blocked_ = false;
+        OFFBOARD_LOG("\n[ INFO] Leg to [%.1f, %.1f, %.1f] blocked, detour through %zu waypoint(s) planned in %.1f (ms)\n", setpoint_.x(), setpoint_.y(), setpoint_.z(), detour_.size(), planning_ms);
+        return;
+    }
+    detour_.clear();
+    OFFBOARD_LOG("\n[ WARN] Leg to [%.1f, %.1f, %.1f] blocked and no detour found, holding position\n", setpoint_.x(), setpoint_.y(), setpoint_.z());
+}
+
+/* waypoint a straight-carrot loop flies to this tick: the leg is validated (and a detour requested) when
+   the setpoint moved, the detour is taken once planned, a leg without detour is planned again 10 ticks
+   after the search failed, reached detour waypoints are dropped
+   input: current position and setpoint (ENU) */
+Eigen::Vector3d LegGuard::waypoint(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint) {
+    if (!enable_) {
+        return setpoint;
+    }
+    if (!valid_ || (setpoint - setpoint_).norm() > detour_error_ || (blocked_ && !planning_ && ++replan_ticks_ >= 10)) {
+        setpoint_ = setpoint;
+        blocked_ = !plan(current, setpoint);
+        valid_ = true;
+        replan_ticks_ = 0;
+    }
+    if (planning_) {
+        takeDetour();
+    }
+    if (!detour_.empty() && (detour_.front() - current).norm() < detour_error_) {
+        detour_.erase(detour_.begin());
+    }
+    return detour_.empty() ? setpoint : detour_.front();
+}
+
+/* check the step commanded this tick against the map, inside the safety margin the planned path,
+   which leads out of it, is trusted
+   input: current position and carrot, output: false when the step is blocked (the leg is planned again) */
+bool LegGuard::stepFree(const Eigen::Vector3d &current, const Eigen::Vector3d &carrot) {
+    if (!enable_) {
+        return true;
+    }
+    const bool free = !blocked_ && (!map_.pointFree(current) || map_.segmentFree(current, carrot));
+    if (!free && !blocked_) {
+        valid_ = false;
+    }
+    return free;
+}
+
+Eigen::Vector3d LegGuard::checkedCarrot(const Eigen::Vector3d &current, const Eigen::Vector3d &carrot) {
+    if (stepFree(current, carrot)) {
+        hold_ = current;
+        return carrot;
+    }
+    OFFBOARD_LOG_THROTTLE(log_period_, "Blocked, holding \n");
+    return hold_;
+}
+
+EnuTick enuTick(LegGuard &leg, const Eigen::Vector3d &current, double yaw, const Eigen::Vector3d &setpoint, double v_desired, double yaw_rate, Eigen::Vector3d &hold) {
+    EnuTick tick;
+    const Eigen::Vector3d active = leg.waypoint(current, setpoint);
+    tick.distance = (active - current).norm();
+    const Eigen::Vector3d carrot = current + velocityTowards(legVelocity(tick.distance, v_desired), current, active);
+
+    const double target_alpha = unwrapYaw(yaw, bearingTo(current, active));
+    // the yaw command moves at most yaw_rate away from the current yaw angle every tick, this make the drone yaw slower
+    tick.yaw = yawStep(yaw, target_alpha, yaw_rate);
+
+    // rotate at current position if yaw angle needed higher than ROTATE_THRESHOLD, otw exec both moving and yaw at the same time
+    // every commanded step is checked against the map, a blocked step holds position and forces a replan
+    tick.blocked = !leg.stepFree(current, carrot);
+    tick.rotating = std::abs(yaw - target_alpha) >= ROTATE_THRESHOLD;
+    if (!tick.blocked && !tick.rotating) {
+        tick.position = carrot;
+        hold = current;
+    }
+    else {
+        // using the hold position as target help the drone reduce drift
+        tick.position = hold;
+    }
+    return tick;
+}
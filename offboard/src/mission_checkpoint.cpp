@@ -0,0 +1,261 @@
+#include "offboard/mission_checkpoint.h"
+#include "offboard/realtime.h"
+
+#include<algorithm>
+#include<cerrno>
+#include<cstdio>
+#include<cstring>
+#include<fstream>
+#include<sstream>
+#include<utility>
+
+#include<fcntl.h>
+#include<unistd.h>
+
+namespace
+{
+
+void writeList(std::ostringstream &out, const char *key, const std::vector<double> &values) {
+    out << key << " " << values.size();
+    for (double v : values) {
+        out << " " << v;
+    }
+    out << "\n";
+}
+
+bool readList(std::istringstream &in, std::vector<double> &values) {
+    size_t n;
+    if (!(in >> n)) {
+        return false;
+    }
+    values.resize(n);
+    for (size_t k = 0; k < n; k++) {
+        if (!(in >> values[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* fsync the directory holding path so the rename itself is durable */
+void syncDirectory(const std::string &path) {
+    std::string dir = ".";
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = (slash == 0) ? "/" : path.substr(0, slash);
+    }
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+} // namespace
+
+void MissionCheckpoint::setTargets(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int n) {
+    n = std::max(0, std::min(n, static_cast<int>(std::min(x.size(), std::min(y.size(), z.size())))));
+    x_target.assign(x.begin(), x.begin() + n);
+    y_target.assign(y.begin(), y.begin() + n);
+    z_target.assign(z.begin(), z.begin() + n);
+}
+
+MissionCheckpointFile::MissionCheckpointFile(const std::string &path) : path_(path) {
+}
+
+bool MissionCheckpointFile::save(const MissionCheckpoint &checkpoint) const {
+    if (!enabled()) {
+        return false;
+    }
+    std::ostringstream out;
+    out.precision(17);
+    out << "next_target " << checkpoint.next_target << "\n";
+    out << "deliveries_completed " << checkpoint.deliveries_completed << "\n";
+    out << "returning_home " << (checkpoint.returning_home ? 1 : 0) << "\n";
+    out << "home_position " << checkpoint.home_x << " " << checkpoint.home_y << " " << checkpoint.home_z << "\n";
+    out << "home_orientation " << checkpoint.home_qx << " " << checkpoint.home_qy << " " << checkpoint.home_qz << " " << checkpoint.home_qw << "\n";
+    out << "home_gps " << checkpoint.home_latitude << " " << checkpoint.home_longitude << " " << checkpoint.home_altitude << "\n";
+    out << "ref_gps " << checkpoint.ref_latitude << " " << checkpoint.ref_longitude << " " << checkpoint.ref_altitude << "\n";
+    out << "offset " << checkpoint.x_offset << " " << checkpoint.y_offset << " " << checkpoint.z_offset << "\n";
+    writeList(out, "x_target", checkpoint.x_target);
+    writeList(out, "y_target", checkpoint.y_target);
+    writeList(out, "z_target", checkpoint.z_target);
+    const std::string data = out.str();
+
+    const std::string tmp = path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::printf("[ WARN] Can not write checkpoint %s: %s\n", tmp.c_str(), std::strerror(errno));
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::printf("[ WARN] Can not write checkpoint %s: %s\n", tmp.c_str(), std::strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        written += n;
+    }
+    bool ok = (::fsync(fd) == 0);
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || ::rename(tmp.c_str(), path_.c_str()) != 0) {
+        std::printf("[ WARN] Can not store checkpoint %s: %s\n", path_.c_str(), std::strerror(errno));
+        return false;
+    }
+    syncDirectory(path_);
+    return true;
+}
+
+bool MissionCheckpointFile::load(MissionCheckpoint &checkpoint) const {
+    if (!enabled()) {
+        return false;
+    }
+    std::ifstream in(path_.c_str());
+    if (!in.is_open()) {
+        return false;
+    }
+    MissionCheckpoint result;
+    int fields = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        std::string key;
+        if (!(ss >> key)) {
+            continue;
+        }
+        bool ok;
+        if (key == "next_target") {
+            ok = static_cast<bool>(ss >> result.next_target);
+        }
+        else if (key == "deliveries_completed") {
+            ok = static_cast<bool>(ss >> result.deliveries_completed);
+        }
+        else if (key == "returning_home") {
+            int returning_home = 0;
+            ok = static_cast<bool>(ss >> returning_home);
+            result.returning_home = (returning_home != 0);
+        }
+        else if (key == "home_position") {
+            ok = static_cast<bool>(ss >> result.home_x >> result.home_y >> result.home_z);
+        }
+        else if (key == "home_orientation") {
+            ok = static_cast<bool>(ss >> result.home_qx >> result.home_qy >> result.home_qz >> result.home_qw);
+        }
+        else if (key == "home_gps") {
+            ok = static_cast<bool>(ss >> result.home_latitude >> result.home_longitude >> result.home_altitude);
+        }
+        else if (key == "ref_gps") {
+            ok = static_cast<bool>(ss >> result.ref_latitude >> result.ref_longitude >> result.ref_altitude);
+        }
+        else if (key == "offset") {
+            ok = static_cast<bool>(ss >> result.x_offset >> result.y_offset >> result.z_offset);
+        }
+        else if (key == "x_target") {
+            ok = readList(ss, result.x_target);
+        }
+        else if (key == "y_target") {
+            ok = readList(ss, result.y_target);
+        }
+        else if (key == "z_target") {
+            ok = readList(ss, result.z_target);
+        }
+        else {
+            continue;
+        }
+        if (!ok) {
+            std::printf("[ WARN] Invalid checkpoint entry '%s' in %s\n", key.c_str(), path_.c_str());
+            return false;
+        }
+        fields++;
+    }
+    if (fields < 10 || result.x_target.size() != result.y_target.size() || result.x_target.size() != result.z_target.size() ||
+        result.next_target < 0 || result.next_target >= static_cast<int>(result.x_target.size())) {
+        std::printf("[ WARN] Incomplete checkpoint %s\n", path_.c_str());
+        return false;
+    }
+    checkpoint = result;
+    return true;
+}
+
+void MissionCheckpointFile::clear() const {
+    if (enabled()) {
+        ::unlink(path_.c_str());
+    }
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    stop();
+}
+
+void CheckpointWriter::start(const MissionCheckpointFile &file) {
+    stop();
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ = file;
+    running_ = true;
+    thread_ = std::thread(&CheckpointWriter::run, this);
+}
+
+void CheckpointWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void CheckpointWriter::reserve(size_t targets) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (MissionCheckpoint *checkpoint : {&pending_, &writing_}) {
+        checkpoint->x_target.reserve(targets);
+        checkpoint->y_target.reserve(targets);
+        checkpoint->z_target.reserve(targets);
+    }
+}
+
+void CheckpointWriter::post(const MissionCheckpoint &checkpoint) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!running_) {
+        lock.unlock();
+        file_.save(checkpoint);
+        return;
+    }
+    pending_ = checkpoint; // copy assignment keeps the reserved capacity
+    posted_ = true;
+    lock.unlock();
+    wake_.notify_one();
+}
+
+void CheckpointWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return !running_ || (!posted_ && !busy_); });
+}
+
+void CheckpointWriter::run() {
+    // started after the mission thread entered real-time, whose SCHED_FIFO priority and CPU are inherited
+    leaveRealtime();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return !running_ || posted_; });
+        if (!posted_) {
+            break;
+        }
+        // swapped, not copied: both checkpoints keep their reserved setpoint lists
+        std::swap(pending_, writing_);
+        posted_ = false;
+        busy_ = true;
+        lock.unlock();
+        file_.save(writing_);
+        lock.lock();
+        busy_ = false;
+        idle_.notify_all();
+    }
+    idle_.notify_all();
+}
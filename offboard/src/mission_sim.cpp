@@ -0,0 +1,292 @@
+#include "offboard/mission_sim.h"
+#include "offboard/control_law.h"
+
+#include<algorithm>
+#include<cmath>
+#include<deque>
+
+namespace
+{
+
+double wrapAngle(double angle) {
+    return std::atan2(std::sin(angle), std::cos(angle));
+}
+
+/* odometry message as received by the node */
+struct OdomSample
+{
+    double stamp; // time of the estimate (s)
+    Eigen::Vector3d position; // estimated position (m)
+    double yaw; // estimated heading (rad)
+    double vz; // estimated vertical velocity (m/s)
+};
+
+/* kinematic vehicle flown by the PX4 position, velocity and yaw loops on its own (drifting, noisy) estimate */
+class SimVehicle
+{
+  public:
+    SimVehicle(const SimScenario &scenario, const SimConfig &config);
+
+    void setTarget(const Eigen::Vector3d &position, double yaw) { target_ = position; target_yaw_ = yaw; } // position setpoint in the odometry frame
+    void autoLand(); // hold the horizontal estimate and descend at auto_land_velocity
+    void armTouchdown(TouchdownDetector *detector) { detector_ = detector; } // feed every odometry sample to detector
+    void advance(double duration); // integrate until the next control tick
+    const OdomSample &odom() const { return received_.front(); } // latest odometry the node has received
+    double time() const { return time_; }
+    bool landed() const { return landed_; } // on the ground after a flight
+    const Eigen::Vector3d &position() const { return position_; } // true ENU position
+
+  private:
+    const SimScenario &scenario_;
+    const SimConfig &config_;
+    std::mt19937 rng_;
+    std::normal_distribution<double> normal_;
+    const double noise_decay_; // per step decay of the odometry error (1 s correlation)
+    const double gust_decay_; // per step decay of the gusts
+    const double velocity_gain_; // per step gain of the velocity loop
+
+    double time_ = 0.0; // simulated time (s)
+    double next_tick_ = 0.0; // end of the current control tick (s)
+    Eigen::Vector3d position_; // true position (m)
+    Eigen::Vector3d velocity_ = Eigen::Vector3d::Zero(); // velocity commanded by the FCU velocity loop (m/s)
+    Eigen::Vector3d gust_ = Eigen::Vector3d::Zero(); // gust velocity (m/s)
+    Eigen::Vector3d gust_rejected_ = Eigen::Vector3d::Zero(); // part of gust_ compensated by the velocity loop (m/s)
+    Eigen::Vector3d drift_ = Eigen::Vector3d::Zero(); // odometry drift (m)
+    Eigen::Vector3d noise_ = Eigen::Vector3d::Zero(); // correlated odometry error (m)
+    double yaw_; // true heading (rad)
+    Eigen::Vector3d target_; // position setpoint (m)
+    double target_yaw_; // yaw setpoint (rad)
+    bool auto_land_ = false;
+    Eigen::Vector2d land_hold_; // horizontal estimate held by AUTO.LAND (m)
+    bool airborne_ = false;
+    bool landed_ = false;
+    TouchdownDetector *detector_ = nullptr;
+    std::deque<OdomSample> received_; // odometry in flight to the node, front is the latest delivered
+
+    Eigen::Vector3d gaussian(double sigma_h, double sigma_v);
+    void step();
+};
+
+SimVehicle::SimVehicle(const SimScenario &scenario, const SimConfig &config) : scenario_(scenario),
+                                                                              config_(config),
+                                                                              rng_(scenario.seed),
+                                                                              noise_decay_(std::exp(-config.dt)),
+                                                                              gust_decay_(std::exp(-config.dt / config.gust_tau)),
+                                                                              velocity_gain_(1 - std::exp(-config.dt / config.velocity_tau)),
+                                                                              position_(Eigen::Vector3d::Zero()),
+                                                                              yaw_(scenario.initial_yaw),
+                                                                              target_(Eigen::Vector3d::Zero()),
+                                                                              target_yaw_(scenario.initial_yaw) {
+    received_.push_back({0.0, Eigen::Vector3d::Zero(), yaw_, 0.0});
+}
+
+Eigen::Vector3d SimVehicle::gaussian(double sigma_h, double sigma_v) {
+    return Eigen::Vector3d(sigma_h * normal_(rng_), sigma_h * normal_(rng_), sigma_v * normal_(rng_));
+}
+
+void SimVehicle::autoLand() {
+    auto_land_ = true;
+    land_hold_ = (position_ + drift_ + noise_).head<2>();
+}
+
+void SimVehicle::advance(double duration) {
+    next_tick_ += duration;
+    while (time_ < next_tick_ - 1e-9 && !(auto_land_ && landed_)) {
+        step();
+    }
+}
+
+void SimVehicle::step() {
+    const double dt = config_.dt;
+
+    // FCU estimate: true position, random walk drift and a slowly varying (filtered) error
+    drift_ += gaussian(scenario_.drift_rate, 0.5 * scenario_.drift_rate) * std::sqrt(dt);
+    noise_ = noise_decay_ * noise_ + gaussian(scenario_.odom_noise, scenario_.odom_noise) * std::sqrt(1 - noise_decay_ * noise_decay_);
+    const Eigen::Vector3d estimate = position_ + drift_ + noise_;
+
+    // position loop on the estimate, velocity loop as a first order lag
+    Eigen::Vector3d velocity_setpoint;
+    if (auto_land_) {
+        velocity_setpoint << config_.xy_p * (land_hold_ - estimate.head<2>()), -config_.auto_land_velocity;
+    }
+    else {
+        velocity_setpoint << config_.xy_p * (target_ - estimate).head<2>(), config_.z_p * (target_.z() - estimate.z());
+    }
+    const double horizontal = velocity_setpoint.head<2>().norm();
+    if (horizontal > config_.max_velocity_xy) {
+        velocity_setpoint.head<2>() *= config_.max_velocity_xy / horizontal;
+    }
+    velocity_setpoint.z() = std::min(std::max(velocity_setpoint.z(), -config_.max_velocity_down), config_.max_velocity_up);
+    velocity_ += (velocity_setpoint - velocity_) * velocity_gain_;
+
+    // gusts (Ornstein-Uhlenbeck), the velocity loop rejects them with its own lag: only the high-pass part moves the vehicle
+    gust_ = gust_decay_ * gust_ + gaussian(scenario_.gust_sigma, 0.3 * scenario_.gust_sigma) * std::sqrt(1 - gust_decay_ * gust_decay_);
+    gust_rejected_ += (gust_ - gust_rejected_) * velocity_gain_;
+
+    Eigen::Vector3d velocity = velocity_ + (airborne_ ? Eigen::Vector3d(gust_ - gust_rejected_) : Eigen::Vector3d::Zero());
+    position_ += velocity * dt;
+    if (position_.z() <= 0.0) {
+        // on the ground: no sliding, no sinking
+        position_.z() = 0.0;
+        velocity_ = velocity_.cwiseProduct(Eigen::Vector3d(0.0, 0.0, 1.0)).cwiseMax(0.0);
+        velocity = velocity_;
+        landed_ = airborne_;
+    }
+    else if (position_.z() > 0.1) {
+        airborne_ = true;
+        landed_ = false;
+    }
+    yaw_ = wrapAngle(yaw_ + std::min(std::max(config_.yaw_p * wrapAngle(target_yaw_ - yaw_), -config_.max_yaw_rate), config_.max_yaw_rate) * dt);
+    time_ += dt;
+
+    // odometry reaches the node latency seconds later
+    received_.push_back({time_, position_ + drift_ + noise_, wrapAngle(yaw_ + scenario_.yaw_noise * normal_(rng_)),
+                         velocity.z() + scenario_.odom_noise * normal_(rng_)});
+    while (received_.size() > 1 && received_[1].stamp <= time_ - scenario_.latency) {
+        received_.pop_front();
+        if (detector_ != nullptr) {
+            const OdomSample &sample = received_.front();
+            detector_->addSample(sample.stamp, sample.position.z(), sample.position.z(), sample.vz, -1.0);
+        }
+    }
+}
+
+/* the flight functions of OffboardControl on the simulated vehicle, without ROS */
+class SimMission
+{
+  public:
+    SimMission(const TuningParams &params, const SimScenario &scenario, const SimConfig &config) : params_(params),
+                                                                                                   scenario_(scenario),
+                                                                                                   config_(config),
+                                                                                                   vehicle_(scenario, config) {}
+    SimResult run();
+
+  private:
+    const TuningParams &params_;
+    const SimScenario &scenario_;
+    const SimConfig &config_;
+    SimVehicle vehicle_;
+
+    bool running() const { return vehicle_.time() < config_.timeout; }
+    Eigen::Vector3d current() const { return vehicle_.odom().position; }
+    double yaw() const { return vehicle_.odom().yaw; }
+    bool takeOff(const Eigen::Vector3d &setpoint);
+    void hovering(const Eigen::Vector3d &setpoint, double yaw, double hover_time);
+    bool enuYawFlight();
+    bool landingYaw(const Eigen::Vector3d &land_position, double yaw);
+};
+
+bool SimMission::takeOff(const Eigen::Vector3d &setpoint) {
+    const double yaw_hold = yaw();
+    while (running()) {
+        vehicle_.setTarget(current() + velocityTowards(params_.desired_velocity, current(), setpoint), yaw_hold);
+        if ((setpoint - current()).norm() < params_.target_error) {
+            hovering(setpoint, yaw_hold, config_.takeoff_hover_time);
+            return true;
+        }
+        vehicle_.advance(1.0 / config_.control_rate);
+    }
+    return false;
+}
+
+void SimMission::hovering(const Eigen::Vector3d &setpoint, double yaw, double hover_time) {
+    vehicle_.setTarget(setpoint, yaw);
+    vehicle_.advance(hover_time);
+}
+
+/* enuYawFlightAndLandingSetpoint without map, delivery and return home */
+bool SimMission::enuYawFlight() {
+    size_t i = 0;
+    Eigen::Vector3d current_hold = current();
+    while (running()) {
+        // setpoints are converted to the odometry frame with the measured offset
+        const Eigen::Vector3d setpoint = scenario_.targets[i] + scenario_.gps_offset;
+        const bool final_position = (i + 1 == scenario_.targets.size());
+        const Eigen::Vector3d position = current();
+
+        const Eigen::Vector3d velocity = velocityTowards(legVelocity((setpoint - position).norm(), params_.desired_velocity), position, setpoint);
+        const double target_alpha = unwrapYaw(yaw(), bearingTo(position, setpoint));
+        const double this_loop_alpha = yawStep(yaw(), target_alpha, params_.yaw_rate);
+        if (std::abs(yaw() - target_alpha) < ROTATE_THRESHOLD) {
+            vehicle_.setTarget(position + velocity, this_loop_alpha);
+            current_hold = position;
+        }
+        else {
+            vehicle_.setTarget(current_hold, this_loop_alpha);
+        }
+
+        if ((setpoint - position).norm() < params_.target_error) {
+            if (!final_position) {
+                i++;
+            }
+            else {
+                hovering(position, yaw(), config_.hover_time);
+                return landingYaw(Eigen::Vector3d(setpoint.x(), setpoint.y(), 0.0), yaw());
+            }
+        }
+        vehicle_.advance(1.0 / config_.control_rate);
+    }
+    return false;
+}
+
+bool SimMission::landingYaw(const Eigen::Vector3d &land_position, double yaw) {
+    TouchdownDetector detector;
+    detector.configure(config_.touchdown_window, config_.touchdown_max_speed, config_.touchdown_max_spread,
+                       config_.touchdown_max_height, 1.0);
+    vehicle_.armTouchdown(&detector);
+    while (running()) {
+        const Eigen::Vector3d position = current();
+        vehicle_.setTarget(position + velocityTowards(config_.descent.velocity(position.z() - land_position.z()), position, land_position), yaw);
+        if ((land_position - position).norm() < params_.land_error || detector.landed()) {
+            // AUTO.LAND takes over until the FCU is on the ground
+            vehicle_.autoLand();
+            while (running() && !vehicle_.landed()) {
+                vehicle_.advance(1.0 / config_.land_rate);
+            }
+            return vehicle_.landed();
+        }
+        vehicle_.advance(1.0 / config_.land_rate);
+    }
+    return false;
+}
+
+SimResult SimMission::run() {
+    SimResult result;
+    const Eigen::Vector3d start = current();
+    result.success = !scenario_.targets.empty() &&
+                     takeOff(Eigen::Vector3d(start.x(), start.y(), params_.z_takeoff)) &&
+                     enuYawFlight();
+    result.mission_time = vehicle_.time();
+    if (!scenario_.targets.empty()) {
+        result.landing_error = (vehicle_.position() - scenario_.targets.back()).head<2>().norm();
+    }
+    return result;
+}
+
+} // namespace
+
+void generateScenario(const ScenarioRanges &ranges, std::mt19937 &rng, SimScenario &scenario) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> normal;
+    const int count = std::uniform_int_distribution<int>(1, std::max(ranges.max_targets, 1))(rng);
+    scenario.targets.clear();
+    for (int k = 0; k < count; k++) {
+        const double r = ranges.radius * std::sqrt(unit(rng));
+        const double theta = 2 * M_PI * unit(rng);
+        scenario.targets.push_back(Eigen::Vector3d(r * std::cos(theta), r * std::sin(theta),
+                                                   ranges.min_altitude + (ranges.max_altitude - ranges.min_altitude) * unit(rng)));
+    }
+    scenario.initial_yaw = M_PI * (2 * unit(rng) - 1);
+    scenario.gust_sigma = ranges.gust_ratio * ranges.wind_max * unit(rng);
+    scenario.gps_offset << ranges.gps_sigma * normal(rng), ranges.gps_sigma * normal(rng), ranges.gps_sigma / 3 * normal(rng);
+    scenario.drift_rate = ranges.drift_max * unit(rng);
+    scenario.odom_noise = ranges.odom_noise_max * unit(rng);
+    scenario.yaw_noise = ranges.yaw_noise;
+    scenario.latency = ranges.latency_max * unit(rng);
+    scenario.seed = rng();
+}
+
+SimResult simulateMission(const TuningParams &params, const SimScenario &scenario, const SimConfig &config) {
+    SimMission mission(params, scenario, config);
+    return mission.run();
+}
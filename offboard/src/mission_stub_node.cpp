@@ -0,0 +1,139 @@
+#include<ros/ros.h>
+#include<mavros_msgs/CommandCode.h>
+#include<mavros_msgs/Waypoint.h>
+#include<mavros_msgs/WaypointList.h>
+#include<mavros_msgs/WaypointPush.h>
+#include<mavros_msgs/WaypointClear.h>
+#include<mavros_msgs/WaypointReached.h>
+
+#include<cmath>
+#include<cstdio>
+#include<vector>
+
+/* local stand-in for the MAVROS mission plugin, to check mission_upload_enable without an FCU
+   serves mavros/mission/push and mavros/mission/clear, validates and prints the uploaded items,
+   latches them on mavros/mission/waypoints and, when reach_interval > 0, reports one reached
+   item every reach_interval seconds on mavros/mission/reached like an FCU flying the mission.
+   Do not run it next to a MAVROS instance with the mission plugin loaded */
+class MissionStub
+{
+  public:
+	MissionStub(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private);
+	void update(); // publish the next reached item when it is due
+
+  private:
+	ros::NodeHandle nh_;
+	ros::NodeHandle nh_private_;
+	ros::ServiceServer push_server_; // mission/push service
+	ros::ServiceServer clear_server_; // mission/clear service
+	ros::Publisher reached_pub_; // mission/reached publisher
+	ros::Publisher waypoints_pub_; // mission/waypoints publisher (latched)
+
+	std::vector<mavros_msgs::Waypoint> items_; // current mission
+	double reach_interval_; // time between two reached items (s), <= 0 never reaches
+	int next_reached_ = -1; // next item to report, -1 when no mission is flown
+	ros::Time next_time_; // when to report next_reached_
+
+	bool pushCallback(mavros_msgs::WaypointPush::Request &req, mavros_msgs::WaypointPush::Response &res);
+	bool clearCallback(mavros_msgs::WaypointClear::Request &req, mavros_msgs::WaypointClear::Response &res);
+	bool validItem(const mavros_msgs::Waypoint &item, size_t index); // check frame, command and coordinates
+	void publishWaypoints();
+};
+
+MissionStub::MissionStub(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private) : nh_(nh),
+                                                                                       nh_private_(nh_private) {
+    nh_private_.param<double>("reach_interval", reach_interval_, 2.0);
+
+    push_server_ = nh_.advertiseService("mavros/mission/push", &MissionStub::pushCallback, this);
+    clear_server_ = nh_.advertiseService("mavros/mission/clear", &MissionStub::clearCallback, this);
+    reached_pub_ = nh_.advertise<mavros_msgs::WaypointReached>("mavros/mission/reached", 10);
+    waypoints_pub_ = nh_.advertise<mavros_msgs::WaypointList>("mavros/mission/waypoints", 1, true);
+    std::printf("[ INFO] Mission stub ready\n");
+}
+
+bool MissionStub::validItem(const mavros_msgs::Waypoint &item, size_t index) {
+    if (item.frame != mavros_msgs::Waypoint::FRAME_GLOBAL_REL_ALT && item.frame != mavros_msgs::Waypoint::FRAME_GLOBAL) {
+        std::printf("[ WARN] Item %zu: unexpected frame %u\n", index, item.frame);
+        return false;
+    }
+    if (item.command != mavros_msgs::CommandCode::NAV_TAKEOFF && item.command != mavros_msgs::CommandCode::NAV_WAYPOINT &&
+        item.command != mavros_msgs::CommandCode::NAV_LAND) {
+        std::printf("[ WARN] Item %zu: unexpected command %u\n", index, item.command);
+        return false;
+    }
+    if (!std::isfinite(item.x_lat) || !std::isfinite(item.y_long) || !std::isfinite(item.z_alt) ||
+        std::abs(item.x_lat) > 90.0 || std::abs(item.y_long) > 180.0 || item.z_alt < 0.0) {
+        std::printf("[ WARN] Item %zu: invalid position [%.8f, %.8f, %.2f]\n", index, item.x_lat, item.y_long, item.z_alt);
+        return false;
+    }
+    return true;
+}
+
+bool MissionStub::pushCallback(mavros_msgs::WaypointPush::Request &req, mavros_msgs::WaypointPush::Response &res) {
+    res.success = !req.waypoints.empty() && req.start_index == 0 &&
+                  req.waypoints.front().command == mavros_msgs::CommandCode::NAV_TAKEOFF;
+    for (size_t k = 0; k < req.waypoints.size(); k++) {
+        const mavros_msgs::Waypoint &item = req.waypoints[k];
+        std::printf(" Item (%zu): command %u [%.8f, %.8f, %.2f] hold %.1f (s)\n", k, item.command, item.x_lat, item.y_long, item.z_alt, item.param1);
+        res.success = validItem(item, k) && res.success;
+    }
+    if (!res.success) {
+        std::printf("[ WARN] Mission rejected\n");
+        res.wp_transfered = 0;
+        return true;
+    }
+    items_ = req.waypoints;
+    res.wp_transfered = items_.size();
+    std::printf("[ INFO] Mission accepted: %zu items\n", items_.size());
+    publishWaypoints();
+    if (reach_interval_ > 0.0) {
+        next_reached_ = 0;
+        next_time_ = ros::Time::now() + ros::Duration(reach_interval_);
+    }
+    return true;
+}
+
+bool MissionStub::clearCallback(mavros_msgs::WaypointClear::Request &req, mavros_msgs::WaypointClear::Response &res) {
+    items_.clear();
+    next_reached_ = -1;
+    publishWaypoints();
+    res.success = true;
+    return true;
+}
+
+void MissionStub::publishWaypoints() {
+    mavros_msgs::WaypointList list;
+    list.current_seq = 0;
+    list.waypoints = items_;
+    waypoints_pub_.publish(list);
+}
+
+void MissionStub::update() {
+    if (next_reached_ < 0 || next_reached_ >= static_cast<int>(items_.size()) || ros::Time::now() < next_time_) {
+        return;
+    }
+    mavros_msgs::WaypointReached reached;
+    reached.header.stamp = ros::Time::now();
+    reached.wp_seq = next_reached_;
+    reached_pub_.publish(reached);
+    std::printf("[ INFO] Reached item %d\n", next_reached_);
+    next_reached_++;
+    next_time_ = ros::Time::now() + ros::Duration(reach_interval_);
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "mission_stub");
+    ros::NodeHandle nh;
+    ros::NodeHandle nh_private("~");
+
+    MissionStub stub(nh, nh_private);
+    ros::Rate rate(20.0);
+    while (ros::ok()) {
+        ros::spinOnce();
+        stub.update();
+        rate.sleep();
+    }
+
+    return 0;
+}
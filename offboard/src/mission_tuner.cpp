@@ -0,0 +1,298 @@
+#include "offboard/mission_sim.h"
+#include "offboard/work_stealing_pool.h"
+
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<numeric>
+#include<string>
+#include<vector>
+
+/* offline Monte-Carlo evaluation and tuning of the ENU flight parameters, no ROS master needed
+   every candidate flies the same randomized missions (common random numbers) on all cores; the baseline is the
+   offboard.launch setting. A Latin hypercube of the parameter space is refined around the Pareto set of
+   (95th percentile mission time, 95th percentile landing error) among candidates with enough successful missions
+   usage: rosrun offboard mission_tuner [key=value ...], keys listed by rosrun offboard mission_tuner help */
+namespace
+{
+
+/* tuned parameter and the range searched */
+struct ParamRange
+{
+    const char *name;
+    double TuningParams::*field;
+    double low, high;
+};
+
+const ParamRange PARAM_RANGES[] = {
+    {"yaw_rate", &TuningParams::yaw_rate, 0.02, 0.3},
+    {"target_error", &TuningParams::target_error, 0.05, 1.0},
+    {"desired_velocity", &TuningParams::desired_velocity, 0.3, 3.0},
+    {"land_error", &TuningParams::land_error, 0.05, 1.0},
+    {"z_takeoff", &TuningParams::z_takeoff, 2.0, 10.0},
+};
+
+/* command line settings */
+struct TunerConfig
+{
+    int runs = 500; // missions per candidate
+    int candidates = 48; // candidates per round
+    int rounds = 4; // first round samples the whole space, the next ones refine around the Pareto set
+    int batch = 25; // missions per pool task
+    unsigned threads = 0; // 0: all cores
+    unsigned seed = 1;
+    double min_success = 0.99; // candidates landing less often are not eligible
+    std::string out; // CSV of every candidate, empty: none
+    ScenarioRanges ranges;
+};
+
+/* distributions of a candidate over the missions */
+struct Evaluation
+{
+    TuningParams params;
+    double success_rate = 0.0;
+    double time_mean = 0.0, time_p50 = 0.0, time_p95 = 0.0; // mission time of the successful missions (s)
+    double error_mean = 0.0, error_p50 = 0.0, error_p95 = 0.0; // landing error of the successful missions (m)
+    bool pareto = false;
+};
+
+bool parseArgument(const char *argument, TunerConfig &config) {
+    const char *equal = std::strchr(argument, '=');
+    if (equal == nullptr) {
+        return false;
+    }
+    const std::string key(argument, equal);
+    const char *value = equal + 1;
+    if (key == "runs") config.runs = std::max(std::atoi(value), 1);
+    else if (key == "candidates") config.candidates = std::max(std::atoi(value), 1);
+    else if (key == "rounds") config.rounds = std::max(std::atoi(value), 1);
+    else if (key == "batch") config.batch = std::max(std::atoi(value), 1);
+    else if (key == "threads") config.threads = static_cast<unsigned>(std::max(std::atoi(value), 0));
+    else if (key == "seed") config.seed = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+    else if (key == "min_success") config.min_success = std::atof(value);
+    else if (key == "out") config.out = value;
+    else if (key == "max_targets") config.ranges.max_targets = std::max(std::atoi(value), 1);
+    else if (key == "radius") config.ranges.radius = std::atof(value);
+    else if (key == "wind_max") config.ranges.wind_max = std::atof(value);
+    else if (key == "gust_ratio") config.ranges.gust_ratio = std::atof(value);
+    else if (key == "gps_sigma") config.ranges.gps_sigma = std::atof(value);
+    else if (key == "drift_max") config.ranges.drift_max = std::atof(value);
+    else if (key == "odom_noise_max") config.ranges.odom_noise_max = std::atof(value);
+    else if (key == "latency_max") config.ranges.latency_max = std::atof(value);
+    else return false;
+    return true;
+}
+
+void printUsage() {
+    std::printf("usage: mission_tuner [key=value ...]\n"
+                "  runs=500 candidates=48 rounds=4 batch=25 threads=0 seed=1 min_success=0.99 out=<csv>\n"
+                "  scenarios: max_targets=4 radius=40 wind_max=8 gust_ratio=0.1 gps_sigma=0.5 drift_max=0.02\n"
+                "             odom_noise_max=0.05 latency_max=0.15\n");
+}
+
+/* nearest rank percentile of sorted values */
+double percentile(const std::vector<double> &sorted, double q) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const size_t rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+
+void summarize(const std::vector<SimResult> &results, Evaluation &evaluation) {
+    std::vector<double> times, errors;
+    for (const SimResult &result : results) {
+        if (result.success) {
+            times.push_back(result.mission_time);
+            errors.push_back(result.landing_error);
+        }
+    }
+    evaluation.success_rate = static_cast<double>(times.size()) / results.size();
+    if (times.empty()) {
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    std::sort(errors.begin(), errors.end());
+    evaluation.time_mean = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+    evaluation.time_p50 = percentile(times, 0.5);
+    evaluation.time_p95 = percentile(times, 0.95);
+    evaluation.error_mean = std::accumulate(errors.begin(), errors.end(), 0.0) / errors.size();
+    evaluation.error_p50 = percentile(errors, 0.5);
+    evaluation.error_p95 = percentile(errors, 0.95);
+}
+
+/* fly every scenario with every candidate on the pool, one task per batch of missions */
+void evaluate(WorkStealingPool &pool, const TunerConfig &config, const std::vector<SimScenario> &scenarios,
+              std::vector<Evaluation> &candidates) {
+    const SimConfig sim;
+    std::vector<std::vector<SimResult>> results(candidates.size(), std::vector<SimResult>(scenarios.size()));
+    for (size_t c = 0; c < candidates.size(); c++) {
+        for (size_t first = 0; first < scenarios.size(); first += config.batch) {
+            const size_t last = std::min(first + config.batch, scenarios.size());
+            pool.submit([&, c, first, last] {
+                for (size_t k = first; k < last; k++) {
+                    results[c][k] = simulateMission(candidates[c].params, scenarios[k], sim);
+                }
+            });
+        }
+    }
+    pool.wait();
+    for (size_t c = 0; c < candidates.size(); c++) {
+        summarize(results[c], candidates[c]);
+    }
+}
+
+bool eligible(const Evaluation &evaluation, const TunerConfig &config) {
+    return evaluation.success_rate >= config.min_success;
+}
+
+bool dominates(const Evaluation &a, const Evaluation &b) {
+    return a.time_p95 <= b.time_p95 && a.error_p95 <= b.error_p95 && (a.time_p95 < b.time_p95 || a.error_p95 < b.error_p95);
+}
+
+void markPareto(std::vector<Evaluation> &evaluations, const TunerConfig &config) {
+    for (Evaluation &a : evaluations) {
+        a.pareto = eligible(a, config);
+        for (const Evaluation &b : evaluations) {
+            if (a.pareto && eligible(b, config) && dominates(b, a)) {
+                a.pareto = false;
+            }
+        }
+    }
+}
+
+/* Latin hypercube: every parameter range split in count strata, each stratum sampled once */
+void latinHypercube(int count, std::mt19937 &rng, std::vector<Evaluation> &candidates) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<Evaluation> samples(count);
+    for (const ParamRange &range : PARAM_RANGES) {
+        std::vector<int> strata(count);
+        std::iota(strata.begin(), strata.end(), 0);
+        std::shuffle(strata.begin(), strata.end(), rng);
+        for (int k = 0; k < count; k++) {
+            samples[k].params.*range.field = range.low + (range.high - range.low) * (strata[k] + unit(rng)) / count;
+        }
+    }
+    candidates.insert(candidates.end(), samples.begin(), samples.end());
+}
+
+/* gaussian steps around the Pareto set, scale is a fraction of each range */
+void refine(const std::vector<Evaluation> &evaluated, int count, double scale, std::mt19937 &rng, std::vector<Evaluation> &candidates) {
+    std::vector<const Evaluation *> front;
+    for (const Evaluation &evaluation : evaluated) {
+        if (evaluation.pareto) {
+            front.push_back(&evaluation);
+        }
+    }
+    if (front.empty()) {
+        latinHypercube(count, rng, candidates);
+        return;
+    }
+    std::normal_distribution<double> normal;
+    for (int k = 0; k < count; k++) {
+        Evaluation candidate;
+        candidate.params = front[k % front.size()]->params;
+        for (const ParamRange &range : PARAM_RANGES) {
+            double &value = candidate.params.*range.field;
+            value = std::min(std::max(value + scale * (range.high - range.low) * normal(rng), range.low), range.high);
+        }
+        candidates.push_back(candidate);
+    }
+}
+
+void printEvaluation(const char *label, const Evaluation &e) {
+    std::printf("%-9s yaw_rate %.3f target_error %.2f desired_velocity %.2f land_error %.2f z_takeoff %.1f\n"
+                "          success %5.1f%%  time mean %.1f p50 %.1f p95 %.1f (s)  landing error mean %.2f p50 %.2f p95 %.2f (m)\n",
+                label, e.params.yaw_rate, e.params.target_error, e.params.desired_velocity, e.params.land_error, e.params.z_takeoff,
+                100.0 * e.success_rate, e.time_mean, e.time_p50, e.time_p95, e.error_mean, e.error_p50, e.error_p95);
+}
+
+bool writeCsv(const std::string &path, const std::vector<Evaluation> &evaluations) {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    for (const ParamRange &range : PARAM_RANGES) {
+        std::fprintf(file, "%s,", range.name);
+    }
+    std::fprintf(file, "success_rate,time_mean,time_p50,time_p95,error_mean,error_p50,error_p95,pareto\n");
+    for (const Evaluation &e : evaluations) {
+        for (const ParamRange &range : PARAM_RANGES) {
+            std::fprintf(file, "%.4f,", e.params.*range.field);
+        }
+        std::fprintf(file, "%.4f,%.2f,%.2f,%.2f,%.4f,%.4f,%.4f,%d\n", e.success_rate, e.time_mean, e.time_p50, e.time_p95,
+                     e.error_mean, e.error_p50, e.error_p95, e.pareto ? 1 : 0);
+    }
+    std::fclose(file);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    TunerConfig config;
+    for (int k = 1; k < argc; k++) {
+        if (!parseArgument(argv[k], config)) {
+            printUsage();
+            return 1;
+        }
+    }
+
+    std::mt19937 rng(config.seed);
+    std::vector<SimScenario> scenarios(config.runs);
+    for (SimScenario &scenario : scenarios) {
+        generateScenario(config.ranges, rng, scenario);
+    }
+    WorkStealingPool pool(config.threads);
+    std::printf("[ INFO] %d missions per candidate, %d candidates x %d rounds on %u threads\n",
+                config.runs, config.candidates, config.rounds, pool.size());
+    const auto t_start = std::chrono::steady_clock::now();
+
+    // the baseline is evaluated with the first round, it is always the first row of the CSV
+    std::vector<Evaluation> evaluated(1);
+    latinHypercube(config.candidates, rng, evaluated);
+    evaluate(pool, config, scenarios, evaluated);
+    markPareto(evaluated, config);
+    for (int round = 1; round < config.rounds; round++) {
+        std::vector<Evaluation> candidates;
+        refine(evaluated, config.candidates, 0.15 / (1 << (round - 1)), rng, candidates);
+        evaluate(pool, config, scenarios, candidates);
+        evaluated.insert(evaluated.end(), candidates.begin(), candidates.end());
+        markPareto(evaluated, config);
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    const double missions = static_cast<double>(evaluated.size()) * config.runs;
+    std::printf("[ INFO] %.0f missions in %.1f (s), %.0f missions/s, %lu tasks stolen\n\n",
+                missions, elapsed, missions / elapsed, static_cast<unsigned long>(pool.steals()));
+
+    printEvaluation("baseline", evaluated.front());
+    if (!eligible(evaluated.front(), config)) {
+        std::printf("[ WARN] Baseline lands in less than %.1f%% of the missions\n", 100.0 * config.min_success);
+    }
+    std::vector<const Evaluation *> front;
+    for (const Evaluation &evaluation : evaluated) {
+        if (evaluation.pareto) {
+            front.push_back(&evaluation);
+        }
+    }
+    std::sort(front.begin(), front.end(), [](const Evaluation *a, const Evaluation *b) { return a->time_p95 < b->time_p95; });
+    std::printf("\n[ INFO] Pareto set (%zu of %zu candidates), fastest first\n", front.size(), evaluated.size());
+    for (const Evaluation *evaluation : front) {
+        printEvaluation(evaluation == &evaluated.front() ? "baseline" : "pareto", *evaluation);
+    }
+
+    if (!config.out.empty()) {
+        if (writeCsv(config.out, evaluated)) {
+            std::printf("\n[ INFO] Candidates written to %s\n", config.out.c_str());
+        }
+        else {
+            std::printf("\n[ WARN] Can not write %s\n", config.out.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -5,40 +5,123 @@ OffboardControl::OffboardControl(const ros::NodeHandle &nh, const ros::NodeHandl
                                                                                                                       nh_private_(nh_private),
                                                                                                                       simulation_mode_enable_(false),
                                                                                                                       delivery_mode_enable_(false),
-                                                                                                                      return_home_mode_enable_(false) {
-    state_sub_ = nh_.subscribe("/mavros/state", 10, &OffboardControl::stateCallback, this);
-    odom_sub_ = nh_.subscribe("/mavros/local_position/odom", 10, &OffboardControl::odomCallback, this);
-    gps_position_sub_ = nh_.subscribe("/mavros/global_position/global", 10, &OffboardControl::gpsPositionCallback, this);
+                                                                                                                      return_home_mode_enable_(false),
+                                                                                                                      stop_requested_(false),
+                                                                                                                      shutdown_on_finish_(input_setpoint),
+                                                                                                                      watchdog_(nh, nh_private),
+                                                                                                                      drift_estimator_(nh, nh_private),
+                                                                                                                      leg_guard_(spatial_map_) {
+    // every instance services its own queue, so several vehicles can share one process
+    nh_.setCallbackQueue(&callback_queue_);
+    nh_private_.setCallbackQueue(&callback_queue_);
+
+    // topic names are relative so each vehicle resolves them inside its own namespace
+    state_sub_ = nh_.subscribe("mavros/state", 10, &OffboardControl::stateCallback, this);
+    odom_sub_ = nh_.subscribe("mavros/local_position/odom", 10, &OffboardControl::odomCallback, this);
+    gps_position_sub_ = nh_.subscribe("mavros/global_position/global", 10, &OffboardControl::gpsPositionCallback, this);
     setpoint_pose_pub_ = nh_.advertise<geometry_msgs::PoseStamped>("mavros/setpoint_position/local", 10);
     odom_error_pub_ = nh_.advertise<nav_msgs::Odometry>("odom_error", 1, true);
-    arming_client_ = nh_.serviceClient<mavros_msgs::CommandBool>("/mavros/cmd/arming");
-    set_mode_client_ = nh_.serviceClient<mavros_msgs::SetMode>("/mavros/set_mode");
-
-    nh_private_.param<bool>("/offboard_node/simulation_mode_enable", simulation_mode_enable_, simulation_mode_enable_);
-    nh_private_.param<bool>("/offboard_node/delivery_mode_enable", delivery_mode_enable_, delivery_mode_enable_);
-    nh_private_.param<bool>("/offboard_node/return_home_mode_enable", return_home_mode_enable_, return_home_mode_enable_);
-    nh_private_.getParam("/offboard_node/number_of_target", num_of_enu_target_);
-    nh_private_.getParam("/offboard_node/target_error", target_error_);
-    nh_private_.getParam("/offboard_node/target_x_pos", x_target_);
-    nh_private_.getParam("/offboard_node/target_y_pos", y_target_);
-    nh_private_.getParam("/offboard_node/target_z_pos", z_target_);
-    nh_private_.getParam("/offboard_node/z_takeoff", z_takeoff_);
-    nh_private_.getParam("/offboard_node/z_delivery", z_delivery_);
-    nh_private_.getParam("/offboard_node/land_error", land_error_);
-    nh_private_.getParam("/offboard_node/takeoff_hover_time", takeoff_hover_time_);
-    nh_private_.getParam("/offboard_node/hover_time", hover_time_);
-    nh_private_.getParam("/offboard_node/unpack_time", unpack_time_);
-    nh_private_.getParam("/offboard_node/desired_velocity", vel_desired_);
-    nh_private_.getParam("/offboard_node/land_velocity", land_vel_);
-    nh_private_.getParam("/offboard_node/return_velcity", return_vel_);
-
-    nh_private_.getParam("/offboard_node/yaw_rate", yaw_rate_);
-    // nh_private_.getParam("/offboard_node/yaw_error", yaw_error_);
-    nh_private_.getParam("/offboard_node/odom_error", odom_error_);
+    arming_client_ = nh_.serviceClient<mavros_msgs::CommandBool>("mavros/cmd/arming");
+    set_mode_client_ = nh_.serviceClient<mavros_msgs::SetMode>("mavros/set_mode");
+    mission_push_client_ = nh_.serviceClient<mavros_msgs::WaypointPush>("mavros/mission/push");
+    mission_clear_client_ = nh_.serviceClient<mavros_msgs::WaypointClear>("mavros/mission/clear");
+    add_delivery_server_ = nh_.advertiseService("add_delivery", &OffboardControl::addDeliveryCallback, this);
+    cancel_delivery_server_ = nh_.advertiseService("cancel_delivery", &OffboardControl::cancelDeliveryCallback, this);
+    delivery_etas_pub_ = nh_.advertise<offboard::DeliveryEtas>("delivery_etas", 1, true);
+    // marker detector topics (MarkerDetection.py / real_cam.py)
+    marker_p_sub_ = nh_.subscribe("target_pos", 10, &OffboardControl::markerCallback, this);
+    ids_detection_sub_ = nh_.subscribe("ids_detection", 10, &OffboardControl::checkIdsDetectionCallback, this);
+    mission_reached_sub_ = nh_.subscribe("mavros/mission/reached", 10, &OffboardControl::missionReachedCallback, this);
+
+    nh_private_.param<bool>("interactive_input", interactive_input_, input_setpoint);
+
+    nh_private_.param<bool>("simulation_mode_enable", simulation_mode_enable_, simulation_mode_enable_);
+    loadTargetParams();
+    nh_private_.getParam("target_error", target_error_);
+    nh_private_.getParam("z_takeoff", z_takeoff_);
+    nh_private_.getParam("z_delivery", z_delivery_);
+    nh_private_.getParam("land_error", land_error_);
+    nh_private_.getParam("takeoff_hover_time", takeoff_hover_time_);
+    nh_private_.getParam("hover_time", hover_time_);
+    nh_private_.getParam("unpack_time", unpack_time_);
+    nh_private_.getParam("desired_velocity", vel_desired_);
+    nh_private_.getParam("land_velocity", land_vel_);
+    nh_private_.getParam("return_velcity", return_vel_);
+
+    nh_private_.getParam("yaw_rate", yaw_rate_);
+    // nh_private_.getParam("yaw_error", yaw_error_);
+    nh_private_.getParam("odom_error", odom_error_);
+
+    std::string checkpoint_file;
+    nh_private_.param<std::string>("checkpoint_file", checkpoint_file, "");
+    nh_private_.param<bool>("resume_mission", resume_mission_, false);
+    checkpoint_file_ = MissionCheckpointFile(checkpoint_file);
+
+    // descent: land_velocity high above ground, touchdown_velocity below slow_descent_height
+    std::string rangefinder_topic;
+    double touchdown_window, touchdown_max_speed, touchdown_max_spread, touchdown_max_height, touchdown_max_thrust;
+    descent_profile_.fast_velocity = land_vel_;
+    nh_private_.param<double>("touchdown_velocity", descent_profile_.slow_velocity, 0.2);
+    nh_private_.param<double>("slow_descent_height", descent_profile_.slow_height, 1.0);
+    nh_private_.param<double>("descent_blend_height", descent_profile_.blend_height, 1.0);
+    nh_private_.param<double>("land_rate", land_rate_, 20.0);
+    nh_private_.param<double>("touchdown_window", touchdown_window, 0.1);
+    nh_private_.param<double>("touchdown_max_speed", touchdown_max_speed, 0.1);
+    nh_private_.param<double>("touchdown_max_spread", touchdown_max_spread, 0.03);
+    nh_private_.param<double>("touchdown_max_height", touchdown_max_height, 0.3);
+    nh_private_.param<double>("touchdown_max_thrust", touchdown_max_thrust, 0.25);
+    nh_private_.param<std::string>("rangefinder_topic", rangefinder_topic, "");
+    touchdown_detector_.configure(touchdown_window, touchdown_max_speed, touchdown_max_spread, touchdown_max_height, touchdown_max_thrust);
+    thrust_sub_ = nh_.subscribe("mavros/setpoint_raw/target_attitude", 10, &OffboardControl::thrustCallback, this);
+    if (!rangefinder_topic.empty()) {
+        rangefinder_sub_ = nh_.subscribe(rangefinder_topic, 10, &OffboardControl::rangefinderCallback, this);
+    }
+
+    double delivery_budget;
+    nh_private_.param<double>("delivery_budget_ms", delivery_budget, 2.0);
+    delivery_planner_ = DeliveryPlanner(delivery_budget, 8);
+
+    double camera_fx, camera_fy, camera_width, camera_height, search_overlap;
+    nh_private_.param<bool>("marker_landing_enable", marker_landing_enable_, false);
+    nh_private_.param<double>("camera_fx", camera_fx, 391.49725341796875);
+    nh_private_.param<double>("camera_fy", camera_fy, 391.49725341796875);
+    nh_private_.param<double>("camera_width", camera_width, 720.0);
+    nh_private_.param<double>("camera_height", camera_height, 480.0);
+    nh_private_.param<double>("search_overlap", search_overlap, 0.2);
+    nh_private_.param<double>("search_radius", search_radius_, 3.0);
+    nh_private_.param<int>("search_max_rings", search_max_rings_, 2);
+    nh_private_.param<double>("search_max_altitude", search_max_altitude_, 7.0);
+    nh_private_.param<double>("search_velocity", search_velocity_, 1.0);
+    nh_private_.param<double>("marker_timeout", marker_timeout_, 0.5);
+    search_pattern_ = SearchPattern(camera_fx, camera_fy, camera_width, camera_height, search_overlap);
+
+    nh_private_.param<bool>("mission_upload_enable", mission_upload_enable_, false);
+    nh_private_.param<bool>("precision_landing", precision_landing_, true);
+
+    nh_private_.param<bool>("realtime_enable", realtime_enable_, false);
+    nh_private_.param<int>("realtime_cpu", realtime_config_.cpu, -1);
+    nh_private_.param<int>("realtime_priority", realtime_config_.priority, 80);
+
+    nh_private_.param<bool>("async_log_enable", async_log_enable_, true);
+    nh_private_.param<std::string>("log_file", log_file_, "");
+    nh_private_.param<double>("log_period", log_period_, 0.5);
+    log_source_ = AsyncLogger::instance().registerSource(nh_private_.getNamespace());
+
+    std::string map_file;
+    double map_inflation;
+    nh_private_.param<std::string>("map_file", map_file, "");
+    nh_private_.param<double>("map_inflation", map_inflation, 0.5);
+    nh_private_.param<double>("detour_error", detour_error_, 0.5);
+    if (!map_file.empty()) {
+        map_enable_ = spatial_map_.load(map_file, map_inflation);
+        if (map_enable_) {
+            std::printf("[ INFO] Loaded map %s: %zu voxels, %zu geofences\n", map_file.c_str(), spatial_map_.numVoxels(), spatial_map_.numGeofences());
+        }
+    }
+    leg_guard_.configure(map_enable_, detour_error_, log_source_, log_period_);
 
-    waitForPredicate(10.0);
     if (input_setpoint) {
-        inputSetpoint();
+        runMission();
     }
 }
 
@@ -46,22 +129,98 @@ OffboardControl::~OffboardControl() {
 
 }
 
+/* load mission setpoints and modes from parameters
+   called again when the mission starts, so setpoints pushed after launch (e.g. by fleet_allocator) are used */
+void OffboardControl::loadTargetParams() {
+    nh_private_.param<bool>("delivery_mode_enable", delivery_mode_enable_, delivery_mode_enable_);
+    nh_private_.param<bool>("return_home_mode_enable", return_home_mode_enable_, return_home_mode_enable_);
+    nh_private_.getParam("number_of_target", num_of_enu_target_);
+    nh_private_.getParam("target_x_pos", x_target_);
+    nh_private_.getParam("target_y_pos", y_target_);
+    nh_private_.getParam("target_z_pos", z_target_);
+    // number_of_target larger than the position arrays would read past them
+    const int n = static_cast<int>(std::min(x_target_.size(), std::min(y_target_.size(), z_target_.size())));
+    num_of_enu_target_ = std::max(0, std::min(num_of_enu_target_, n));
+}
+
+/* run the whole mission: wait for FCU, take input and fly
+   blocks until the mission is finished or stop is requested */
+void OffboardControl::runMission() {
+    if (async_log_enable_) {
+        // before entering real-time, the writer thread must not inherit SCHED_FIFO
+        AsyncLogger::instance().start(log_file_);
+    }
+    if (realtime_enable_) {
+        // before starting the watchdog, so its thread inherits policy and affinity
+        enterRealtime(realtime_config_);
+    }
+    watchdog_.start();
+    if (map_enable_) {
+        leg_guard_.start();
+    }
+    if (checkpoint_file_.enabled()) {
+        checkpoint_writer_.start(checkpoint_file_);
+    }
+    waitForPredicate(10.0);
+    inputSetpoint();
+}
+
+/* ask the mission loops to return, e.g. when the nodelet is unloaded */
+void OffboardControl::requestStop() {
+    stop_requested_ = true;
+    watchdog_.stop();
+    drift_estimator_.stop();
+    leg_guard_.stop();
+    checkpoint_writer_.stop();
+}
+
+/* end of mission: stop the loops and, when running as a standalone node, shut it down
+   input: touchdown or AUTO.LAND was reached, otherwise the checkpoint is kept for a resume */
+void OffboardControl::finishMission(bool landed) {
+    watchdog_.setActive(false);
+    OFFBOARD_LOG("[ INFO] Control ticks: %ld, missed deadlines: %ld, worst cycle %.1f (ms)\n", deadline_monitor_.ticks(), deadline_monitor_.missed(), deadline_monitor_.worstCycle() * 1e3);
+    OFFBOARD_LOG("[ INFO] Log records written: %lu, rate limited: %lu, dropped: %lu\n", AsyncLogger::instance().written(), AsyncLogger::instance().limited(), AsyncLogger::instance().dropped());
+    if (drift_estimator_.enabled()) {
+        const Eigen::Vector3d drift = drift_estimator_.drift();
+        OFFBOARD_LOG("[ INFO] Odometry drift: [%.2f, %.2f, %.2f] (m), GPS fixes fused: %ld, rejected: %ld\n", drift.x(), drift.y(), drift.z(), drift_estimator_.updates(), drift_estimator_.rejected());
+    }
+    if (watchdog_.tripped()) {
+        // the mission was aborted by the failsafe, keep the checkpoint so it can be resumed
+        OFFBOARD_LOG("\n[ WARN] Mission aborted by watchdog failsafe, checkpoint kept\n");
+    }
+    else if (!landed) {
+        // stopped before landing (e.g. nodelet unloaded during the descent)
+        if (checkpoint_file_.enabled()) {
+            OFFBOARD_LOG("\n[ WARN] Mission stopped before landing, checkpoint kept\n");
+        }
+    }
+    else {
+        // a checkpoint still being written must not land after the removal
+        checkpoint_writer_.flush();
+        checkpoint_file_.clear();
+    }
+    stop_requested_ = true;
+    if (shutdown_on_finish_) {
+        ros::shutdown();
+    }
+}
+
 /* wait for connect, GPS received, ...
    input: ros rate in hertz, at least 2Hz */
 void OffboardControl::waitForPredicate(double hz) {
     ros::Rate rate(hz);
 
     std::printf("\n[ INFO] Waiting for FCU connection \n");
-    while (ros::ok() && !current_state_.connected) {
-        ros::spinOnce();
-        rate.sleep();
+    while (running() && !current_state_.connected) {
+        spinOnce();
+        sleepTick(rate);
     }
     std::printf("[ INFO] FCU connected \n");
 
     std::printf("[ INFO] Waiting for GPS signal \n");
-    while (ros::ok() && !gps_received_) {
-        ros::spinOnce();
-        rate.sleep();
+    while (running() && !gps_received_) {
+        spinOnce();
+        sleepTick(rate);
     }
     std::printf("[ INFO] GPS position received \n");
     if (simulation_mode_enable_) {
@@ -84,18 +243,17 @@ void OffboardControl::waitForPredicate(double hz) {
 
 /* send a few setpoints before publish
    input: ros rate in hertz (at least 2Hz) and first setpoint */
-void OffboardControl::setOffboardStream(double hz, geometry_msgs::PoseStamped first_target) {
+void OffboardControl::setOffboardStream(double hz, const geometry_msgs::PoseStamped &first_target) {
     ros::Rate rate(hz);
     std::printf("[ INFO] Setting OFFBOARD stream \n");
-    for (int i = 50; ros::ok() && i > 0; --i) {
-        target_enu_pose_ = first_target;
+    target_enu_pose_ = first_target;
+    for (int i = 50; running() && i > 0; --i) {
         // std::printf("\n[ INFO] first_target ENU position: [%.1f, %.1f, %.1f]\n", target_enu_pose_.pose.position.x, target_enu_pose_.pose.position.y, target_enu_pose_.pose.position.z);
-        target_enu_pose_.header.stamp = ros::Time::now();
         // std::printf("\n[ INFO] second ENU position: [%.1f, %.1f, %.1f]\n", target_enu_pose_.pose.position.x, target_enu_pose_.pose.position.y, target_enu_pose_.pose.position.z);
-        setpoint_pose_pub_.publish(target_enu_pose_);
+        publishTarget(positionOf(first_target.pose.position), first_target.pose.orientation);
         // std::printf("\n[ INFO] publish ENU position: [%.1f, %.1f, %.1f]\n", target_enu_pose_.pose.position.x, target_enu_pose_.pose.position.y, target_enu_pose_.pose.position.z);
-        ros::spinOnce();
-        rate.sleep();
+        spinOnce();
+        sleepTick(rate);
     }
     std::printf("\n[ INFO] OFFBOARD stream is set\n");
 }
@@ -106,7 +264,7 @@ void OffboardControl::waitForArmAndOffboard(double hz) {
     ros::Rate rate(hz);
     if (simulation_mode_enable_) {
         std::printf("\n[ INFO] Ready to takeoff\n");
-        while (ros::ok() && !current_state_.armed && (current_state_.mode != "OFFBOARD")) {
+        while (running() && !current_state_.armed && (current_state_.mode != "OFFBOARD")) {
             mavros_msgs::CommandBool arm_amd;
             arm_amd.request.value = true;
             if (arming_client_.call(arm_amd) && arm_amd.response.success) {
@@ -119,14 +277,14 @@ void OffboardControl::waitForArmAndOffboard(double hz) {
             // mavros_msgs::SetMode offboard_setmode_;
             offboard_setmode_.request.base_mode = 0;
             offboard_setmode_.request.custom_mode = "OFFBOARD";
-            if (set_mode_client_.call(offboard_setmode_) && offboard_setmode_.response.mode_sent) {
+            if (watchdog_.setMode(set_mode_client_, offboard_setmode_) && offboard_setmode_.response.mode_sent) {
                 ROS_INFO_ONCE("OFFBOARD enabled");
             }
             else {
                 ROS_INFO_ONCE("Failed to set OFFBOARD");
             }
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
         //DuyNguyen
         if (odom_error_) {
@@ -135,15 +293,81 @@ void OffboardControl::waitForArmAndOffboard(double hz) {
     }
     else {
         std::printf("\n[ INFO] Waiting switching (ARM and OFFBOARD mode) from RC\n");
-        while (ros::ok() && !current_state_.armed && (current_state_.mode != "OFFBOARD")) {
-            ros::spinOnce();
-            rate.sleep();
+        while (running() && !current_state_.armed && (current_state_.mode != "OFFBOARD")) {
+            spinOnce();
+            sleepTick(rate);
         }
         //DuyNguyen
         if (odom_error_) {
             odom_error_pub_.publish(current_odom_);
         }
     }
+    // from here on stale inputs trigger the failsafe and control deadlines are counted
+    watchdog_.setActive(running());
+    deadline_monitor_.reset();
+}
+
+/* wait for OFFBOARD before a resumed mission: the vehicle may be armed and flying already (pilot took over
+   in POSCTL, node restarted in flight), so the mode is checked whatever the arming state. The current
+   position is streamed meanwhile: PX4 accepts the switch and the vehicle holds where it is
+   input: ros rate in hertz, at least 2Hz */
+void OffboardControl::waitForOffboard(double hz) {
+    ros::Rate rate(hz);
+    if (simulation_mode_enable_) {
+        std::printf("\n[ INFO] Resuming, setting ARM and OFFBOARD mode\n");
+    }
+    else {
+        std::printf("\n[ INFO] Resuming, waiting switching (ARM and OFFBOARD mode) from RC\n");
+    }
+    while (running() && !(current_state_.armed && current_state_.mode == "OFFBOARD")) {
+        publishTarget(currentPosition(), current_odom_.pose.pose.orientation);
+        if (simulation_mode_enable_) {
+            if (!current_state_.armed) {
+                mavros_msgs::CommandBool arm_cmd;
+                arm_cmd.request.value = true;
+                arming_client_.call(arm_cmd);
+            }
+            offboard_setmode_.request.base_mode = 0;
+            offboard_setmode_.request.custom_mode = "OFFBOARD";
+            watchdog_.setMode(set_mode_client_, offboard_setmode_);
+        }
+        spinOnce();
+        sleepTick(rate);
+    }
+    std::printf("[ INFO] Armed in OFFBOARD mode\n");
+    watchdog_.setActive(running());
+    deadline_monitor_.reset();
+}
+
+/* sleep until the next tick of a mission loop
+   a tick whose work took longer than the period is a missed deadline, reported at most once per second */
+void OffboardControl::sleepTick(ros::Rate &rate) {
+    bool met = rate.sleep();
+    if (deadline_monitor_.tick(met, rate.cycleTime().toSec())) {
+        OFFBOARD_LOG_THROTTLE(1.0, "[ WARN] Missed control deadline: cycle %.1f (ms), %ld of %ld ticks\n", rate.cycleTime().toSec() * 1e3, deadline_monitor_.missed(), deadline_monitor_.ticks());
+    }
+}
+
+/* reserve the vectors used by the flight loops at mission start, so they do not allocate in flight */
+void OffboardControl::reserveContainers() {
+    const size_t targets = static_cast<size_t>(std::max(num_of_enu_target_, 0)) + 64;
+    x_target_.reserve(targets);
+    y_target_.reserve(targets);
+    z_target_.reserve(targets);
+    yaw_target_.reserve(targets);
+    target_ids_.reserve(targets);
+    eta_route_.reserve(targets);
+    eta_.reserve(targets);
+    etas_msg_.ids.reserve(targets);
+    etas_msg_.positions.reserve(targets);
+    etas_msg_.eta.reserve(targets);
+    checkpoint_.x_target.reserve(targets);
+    checkpoint_.y_target.reserve(targets);
+    checkpoint_.z_target.reserve(targets);
+    checkpoint_writer_.reserve(targets);
+    leg_guard_.reserve(256);
+    optimization_point_.reserve(256);
+    AsyncLogger::instance().registerThread();
 }
 
 /* wait drone get a stable state
@@ -159,14 +383,16 @@ void OffboardControl::waitForStable(double hz) {
         x_off_[i] = current_odom_.pose.pose.position.x - converted_enu.x;
         y_off_[i] = current_odom_.pose.pose.position.y - converted_enu.y;
         z_off_[i] = current_odom_.pose.pose.position.z - converted_enu.z;
-        ros::spinOnce();
-        rate.sleep();
+        spinOnce();
+        sleepTick(rate);
     }
+    x_offset_ = y_offset_ = z_offset_ = 0.0;
     for (int i = 0; i < 100; i++) {
         x_offset_ = x_offset_ + x_off_[i] / 100;
         y_offset_ = y_offset_ + y_off_[i] / 100;
         z_offset_ = z_offset_ + z_off_[i] / 100;
     }
+    drift_estimator_.start(ref_gps_position_, Eigen::Vector3d(x_offset_, y_offset_, z_offset_));
     std::printf("[ INFO] Got stable state\n");
 
     home_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z, yaw_);
@@ -188,6 +414,42 @@ void OffboardControl::odomCallback(const nav_msgs::Odometry::ConstPtr &msg) {
     // tf::vectorMsgToEigen(current_odom_.twist.twist.linear, current_velocity_);
     yaw_ = tf::getYaw(current_odom_.pose.pose.orientation); //for "Rotating.."
     // std::cout << "\n[Debug] yaw from odom: " << degreeOf(yaw_) << "\n";
+    if (touchdown_armed_ && !touchdown_detected_) {
+        // evaluated per odometry message, so touchdown is seen between two ticks of the descent loop
+        ros::Time stamp = msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp;
+        double thrust = ((ros::Time::now() - thrust_stamp_).toSec() < 0.5) ? current_thrust_ : -1.0;
+        touchdown_detected_ = touchdown_detector_.addSample(stamp.toSec(), heightAboveGround(), current_odom_.pose.pose.position.z,
+                                                            current_odom_.twist.twist.linear.z, thrust);
+    }
+}
+
+void OffboardControl::rangefinderCallback(const sensor_msgs::Range::ConstPtr &msg) {
+    current_range_ = *msg;
+    range_stamp_ = ros::Time::now();
+}
+
+void OffboardControl::thrustCallback(const mavros_msgs::AttitudeTarget::ConstPtr &msg) {
+    current_thrust_ = msg->thrust;
+    thrust_stamp_ = ros::Time::now();
+}
+
+/* height above ground used by the descent profile and the touchdown detector
+   rangefinder when it is fresh and in range, otherwise odometry altitude above ground_z_ */
+double OffboardControl::heightAboveGround() {
+    if (!range_stamp_.isZero() && (ros::Time::now() - range_stamp_).toSec() < 0.5 &&
+        current_range_.range >= current_range_.min_range && current_range_.range <= current_range_.max_range) {
+        return current_range_.range;
+    }
+    return current_odom_.pose.pose.position.z - ground_z_;
+}
+
+/* arm the touchdown detector for a new descent
+   input: altitude of the ground in the odometry frame */
+void OffboardControl::startDescent(double ground_z) {
+    ground_z_ = ground_z;
+    touchdown_detector_.reset();
+    touchdown_detected_ = false;
+    touchdown_armed_ = true;
 }
 
 void OffboardControl::gpsPositionCallback(const sensor_msgs::NavSatFix::ConstPtr &msg) {
@@ -195,13 +457,24 @@ void OffboardControl::gpsPositionCallback(const sensor_msgs::NavSatFix::ConstPtr
     gps_received_ = true;
 }
 
+void OffboardControl::markerCallback(const geometry_msgs::PoseStamped::ConstPtr &msg) {
+    marker_position_ = *msg;
+    marker_stamp_ = ros::Time::now();
+}
+
+void OffboardControl::checkIdsDetectionCallback(const std_msgs::Bool::ConstPtr &msg) {
+    check_ids_ = msg->data;
+}
+
 /* manage input: select mode, setpoint type, ... */
 void OffboardControl::inputSetpoint() {
-    std::printf("\n[ INFO] Please choose mode\n");
-    char mode;
-    std::printf("- Choose (2): Mission\n");
-    std::printf("(2): ");
-    std::cin >> mode;
+    char mode = '2';
+    if (interactive_input_) {
+        std::printf("\n[ INFO] Please choose mode\n");
+        std::printf("- Choose (2): Mission\n");
+        std::printf("(2): ");
+        std::cin >> mode;
+    }
 
     // // hovering
     if (mode == '2') {
@@ -217,12 +490,31 @@ void OffboardControl::inputSetpoint() {
 
 void OffboardControl::inputENUYawAndLandingSetpoint() {
     ros::Rate rate(10.0);
-    char c;
-    std::printf("\n[ INFO] Please choose input method:\n");
-    std::printf("- Choose 1: Manual enter from keyboard\n");
-    std::printf("- Choose 2: Load prepared from launch file\n");
-    std::printf("(1/2): ");
-    std::cin >> c;
+    if (resume_mission_ && resumeFromCheckpoint()) {
+        reserveContainers();
+        if (mission_upload_enable_ && missionFlight()) {
+            return;
+        }
+        waitForOffboard(10.0);
+        takeOff(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, std::max(z_takeoff_, current_odom_.pose.pose.position.z)), 0.0);
+        if (returning_home_) {
+            // the final setpoint was reached (and its package dropped) before the interruption
+            const int n = num_of_enu_target_ - 1;
+            returnHomeAndLand(driftCorrected(Eigen::Vector3d(x_target_[n], y_target_[n], z_target_[n])).z());
+            return;
+        }
+        std::printf("\n[ INFO] Flight with ENU setpoint and Yaw angle\n");
+        enuYawFlightAndLandingSetpoint();
+        return;
+    }
+    char c = '2';
+    if (interactive_input_) {
+        std::printf("\n[ INFO] Please choose input method:\n");
+        std::printf("- Choose 1: Manual enter from keyboard\n");
+        std::printf("- Choose 2: Load prepared from launch file\n");
+        std::printf("(1/2): ");
+        std::cin >> c;
+    }
     if (c == '1') {
         double x, y, z, yaw;
         std::printf("[ INFO] Manual enter ENU target position(s) to drop packages\n");
@@ -240,25 +532,39 @@ void OffboardControl::inputENUYawAndLandingSetpoint() {
             y_target_.push_back(y);
             z_target_.push_back(z);
             //yaw_target_.push_back(yaw);
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
         std::printf(" Error to check target reached (in meter): ");
         std::cin >> target_error_;
     }
     else if (c == '2') {
+        loadTargetParams();
         std::printf("[ INFO] Loaded prepared setpoints [x, y, z, yaw]\n");
         for (int i = 0; i < num_of_enu_target_; i++) {
             std::printf(" Target (%d): [%.1f, %.1f, %.1f]\n", i + 1, x_target_[i], y_target_[i], z_target_[i]);
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
         std::printf(" Error to check target reached: %.1f (m)\n", target_error_);
     }
     else {
         inputENUYawAndLandingSetpoint();
     }
+    if (num_of_enu_target_ <= 0) {
+        // e.g. fleet_allocator gave this vehicle no drop
+        std::printf("\n[ INFO] No setpoint assigned, staying on the ground\n");
+        finishMission(false);
+        return;
+    }
     waitForStable(10.0);
+    start_target_ = 0;
+    deliveries_completed_ = 0;
+    saveCheckpoint(0);
+    reserveContainers();
+    if (mission_upload_enable_ && missionFlight()) {
+        return;
+    }
     setOffboardStream(10.0, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, z_takeoff_));
     waitForArmAndOffboard(10.0);
     takeOff(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, z_takeoff_), takeoff_hover_time_);
@@ -269,127 +575,509 @@ void OffboardControl::inputENUYawAndLandingSetpoint() {
 
 void OffboardControl::enuYawFlightAndLandingSetpoint() {
     ros::Rate rate(10.0);
-    int i = 0;
-    geometry_msgs::PoseStamped setpoint;
+    int i = start_target_;
+    if (i < 0 || i >= num_of_enu_target_) {
+        // airborne with no setpoint left to fly (empty or inconsistent checkpoint): land where the vehicle is
+        OFFBOARD_LOG("\n[ WARN] No setpoint to fly (target %d of %d), landing\n", i + 1, num_of_enu_target_);
+        landing(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, home_enu_pose_.pose.position.z));
+        return;
+    }
+    if (static_cast<int>(target_ids_.size()) != num_of_enu_target_) {
+        target_ids_.resize(num_of_enu_target_);
+        for (int k = 0; k < num_of_enu_target_; k++) {
+            target_ids_[k] = k;
+        }
+        next_target_id_ = num_of_enu_target_;
+    }
+    current_target_ = i;
+    route_active_ = true;
+    int eta_ticks = 0;
+    publishEtas();
+    Eigen::Vector3d setpoint, current;
     std::printf("\n[ INFO] Target: [%.1f, %.1f, %.1f]\n", x_target_[i], y_target_[i], z_target_[i]);
 
-    double target_alpha,this_loop_alpha;
     //work in progress
     //point to hold position when yaw angle is to high. Save this position and publish this position with yaw when need to rotate high yaw angle will help drone hold position. Update this position constantly when moving
-    double current_hold_x = current_odom_.pose.pose.position.x;
-    double current_hold_y = current_odom_.pose.pose.position.y;
-    double current_hold_z = current_odom_.pose.pose.position.z;
-
-    while (ros::ok()) {
+    Eigen::Vector3d current_hold = currentPosition();
+    // map checks: the straight leg to each setpoint is validated once, a blocked leg is flown through detour waypoints
+    leg_guard_.reset(current_hold);
+
+    while (running()) {
+        current_target_ = i;
+        if (route_changed_) {
+            // setpoints were added or cancelled between two ticks, the leg to the (new) current setpoint is checked again
+            leg_guard_.reset(currentPosition());
+            route_changed_ = false;
+        }
+        if (++eta_ticks >= 10) {
+            publishEtas();
+            eta_ticks = 0;
+        }
         if (i < (num_of_enu_target_ - 1)) {
             final_position_reached_ = false;
-            setpoint = targetTransfer(x_target_[i], y_target_[i], z_target_[i]);
+            setpoint << x_target_[i], y_target_[i], z_target_[i];
         }
         else {
             final_position_reached_ = true;
-            setpoint = targetTransfer(x_target_[num_of_enu_target_ - 1], y_target_[num_of_enu_target_ - 1], z_target_[num_of_enu_target_ - 1]);
-        }
-
-        if(distanceBetween(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint) < 3) {
-            components_vel_ = velComponentsCalc(0.3, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
-        }
-        else {
-            components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
-        }
-
-        target_alpha = calculateYawOffset(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
-
-        // test to know what direction drone need to spin
-        if ((yaw_ - target_alpha) >= PI) {
-            target_alpha += 2*PI;
+            setpoint << x_target_[num_of_enu_target_ - 1], y_target_[num_of_enu_target_ - 1], z_target_[num_of_enu_target_ - 1];
         }
-        else if ((yaw_ - target_alpha) <= -PI) {
-            target_alpha-=2*PI;
+        setpoint = driftCorrected(setpoint);
+
+        current = currentPosition();
+        // the per-tick work is shared with test_tick_allocations
+        const EnuTick tick = enuTick(leg_guard_, current, yaw_, setpoint, vel_desired_, yaw_rate_, current_hold);
+        distance_ = tick.distance;
+        publishTarget(tick.position, tf::createQuaternionMsgFromYaw(tick.yaw));
+        if (tick.blocked) {
+            OFFBOARD_LOG_THROTTLE(log_period_, "Blocked, holding \n");
         }
-        else{}
-
-        // calculate the input for position controller (this_loop_alpha) so that the input yaw value will always be higher or lower than current yaw angle (yaw_) a value of yaw_rate_
-        // this make the drone yaw slower
-        if (target_alpha <= yaw_) {
-            if ((yaw_ - target_alpha) > yaw_rate_) {
-                this_loop_alpha = yaw_ - yaw_rate_;
-            }
-            else {
-                this_loop_alpha = target_alpha;
-            }
+        else if (tick.rotating) {
+            OFFBOARD_LOG_THROTTLE(log_period_, "Rotating \n");
         }
-        else{
-            if ((target_alpha - yaw_) > yaw_rate_) {
-                this_loop_alpha = yaw_ + yaw_rate_;
-            }
-            else {
-                this_loop_alpha = target_alpha;
-            }
-        }
-
-        // rotate at current position if yaw angle needed higher than 0.2 rad, otw exec both moving and yaw at the same time
-		if (abs(yaw_ - target_alpha) < 0.2) {	
-			target_enu_pose_.pose.orientation = tf::createQuaternionMsgFromYaw(this_loop_alpha);
-			target_enu_pose_.pose.position.x = current_odom_.pose.pose.position.x + components_vel_.x; 
-			target_enu_pose_.pose.position.y = current_odom_.pose.pose.position.y + components_vel_.y; 
-			target_enu_pose_.pose.position.z = current_odom_.pose.pose.position.z + components_vel_.z; 
-            // update the hold position // detail mention above
-            current_hold_x = current_odom_.pose.pose.position.x;
-            current_hold_y = current_odom_.pose.pose.position.y;
-            current_hold_z = current_odom_.pose.pose.position.z;
-		}
-		else {
-			target_enu_pose_.pose.orientation = tf::createQuaternionMsgFromYaw(this_loop_alpha);
-            //using the hold position as target help the drone reduce drift
-			target_enu_pose_.pose.position.x = current_hold_x;
-			target_enu_pose_.pose.position.y = current_hold_y;
-			target_enu_pose_.pose.position.z = current_hold_z;
-			std::printf("Rotating \n");
-		}
-
-        target_enu_pose_.header.stamp = ros::Time::now();
-        setpoint_pose_pub_.publish(target_enu_pose_);
 
-        distance_ = distanceBetween(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
-        std::printf("Distance to target: %.1f (m) \n", distance_);
+        OFFBOARD_LOG_THROTTLE(log_period_, "Distance to target: %.1f (m) \n", distance_);
 
-        bool target_reached = checkPositionError(target_error_, setpoint);
+        bool target_reached = leg_guard_.clear() && checkPositionError(target_error_, setpoint);
 
 
         if (target_reached && !final_position_reached_) {
-            std::printf("\n[ INFO] Reached position: [%.1f, %.1f, %.1f]\n", current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z);
+            OFFBOARD_LOG("\n[ INFO] Reached position: [%.1f, %.1f, %.1f]\n", current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z);
 
             // hovering(setpoint, hover_time_);
             if (delivery_mode_enable_) {
-                delivery(setpoint, unpack_time_);
+                // services are still served during the drop, they must not move or cancel x/y/z_target_[i]
+                delivering_ = true;
+                delivery(targetTransfer(setpoint.x(), setpoint.y(), setpoint.z()), unpack_time_);
+                delivering_ = false;
+                deliveries_completed_++;
             }
-            std::printf("\n[ INFO] Next target: [%.1f, %.1f, %.1f]\n", x_target_[i + 1], y_target_[i + 1], z_target_[i + 1]);
+            OFFBOARD_LOG("\n[ INFO] Next target: [%.1f, %.1f, %.1f]\n", x_target_[i + 1], y_target_[i + 1], z_target_[i + 1]);
             i += 1;
+            saveCheckpoint(i);
         }
         if (target_reached && final_position_reached_) {
-            std::printf("\n[ INFO] Reached Final position: [%.1f, %.1f, %.1f]\n", current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z);
+            route_active_ = false;
+            OFFBOARD_LOG("\n[ INFO] Reached Final position: [%.1f, %.1f, %.1f]\n", current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z);
             //std::cout << "yaw =" << degreeOf(yaw_) << std::endl;
             hovering(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z, degreeOf(yaw_)), hover_time_);
             if (!return_home_mode_enable_) {
                 // landing(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, 0.0));
-                landingYaw(targetTransfer(setpoint.pose.position.x, setpoint.pose.position.y, 0.0, degreeOf(yaw_)));
+                landingAtMarker(setpoint);
             }
             else {
                 if (delivery_mode_enable_) {
-                    delivery(setpoint, unpack_time_);
+                    delivery(targetTransfer(setpoint.x(), setpoint.y(), setpoint.z()), unpack_time_);
+                    deliveries_completed_++;
                 }
-                std::printf("\n[ INFO] Returning home [%.1f, %.1f, %.1f]\n", home_enu_pose_.pose.position.x, home_enu_pose_.pose.position.y, home_enu_pose_.pose.position.z);
-                returnHome(targetTransfer(home_enu_pose_.pose.position.x, home_enu_pose_.pose.position.y, setpoint.pose.position.z));
-                landing(home_enu_pose_);
+                // a resume from here must not fly back to the final setpoint and drop again
+                saveCheckpoint(num_of_enu_target_ - 1, true);
+                returnHomeAndLand(setpoint.z());
             }
         }
-        ros::spinOnce();
-        rate.sleep();
+        spinOnce();
+        sleepTick(rate);
     }
 }
 // inputENUYawAndLandingSetpoint
 
 
+void OffboardControl::missionReachedCallback(const mavros_msgs::WaypointReached::ConstPtr &msg) {
+    mission_reached_seq_ = std::max(mission_reached_seq_, static_cast<int>(msg->wp_seq));
+}
+
+/* create a mission item at an ENU position of the odometry frame
+   input: MAV_CMD, position and hold time (s). Latitude/longitude come from the GPS converted ENU
+   (odometry minus the current offset of drift_estimator_), the altitude is relative to home */
+mavros_msgs::Waypoint OffboardControl::missionItem(uint16_t command, const Eigen::Vector3d &position, double hold_time) {
+    const Eigen::Vector3d offset = drift_estimator_.offset();
+    geometry_msgs::Point enu;
+    enu.x = position.x() - offset.x();
+    enu.y = position.y() - offset.y();
+    enu.z = position.z() - offset.z();
+    geographic_msgs::GeoPoint gps = ENUToWGS84(enu, ref_gps_position_);
+
+    mavros_msgs::Waypoint item;
+    item.frame = mavros_msgs::Waypoint::FRAME_GLOBAL_REL_ALT;
+    item.command = command;
+    item.is_current = false;
+    item.autocontinue = true;
+    item.param1 = (command == mavros_msgs::CommandCode::NAV_WAYPOINT) ? hold_time : 0.0;
+    item.param2 = (command == mavros_msgs::CommandCode::NAV_WAYPOINT) ? target_error_ : 0.0;
+    item.param3 = 0.0;
+    item.param4 = NAN; // keep the yaw behaviour of the FCU
+    item.x_lat = gps.latitude;
+    item.y_long = gps.longitude;
+    item.z_alt = position.z() - home_enu_pose_.pose.position.z;
+    return item;
+}
+
+/* add the detour waypoints of a leg blocked in the map (the setpoint itself is not added) */
+void OffboardControl::appendMissionLeg(std::vector<mavros_msgs::Waypoint> &items, const Eigen::Vector3d &start, const Eigen::Vector3d &setpoint) {
+    if (!map_enable_ || spatial_map_.segmentFree(start, setpoint)) {
+        return;
+    }
+    std::vector<Eigen::Vector3d> waypoints;
+    if (!spatial_map_.planDetour(start, setpoint, waypoints)) {
+        OFFBOARD_LOG("[ WARN] No detour found to [%.1f, %.1f, %.1f], the mission leg is kept straight\n", setpoint.x(), setpoint.y(), setpoint.z());
+        return;
+    }
+    for (size_t k = 0; k + 1 < waypoints.size(); k++) {
+        items.push_back(missionItem(mavros_msgs::CommandCode::NAV_WAYPOINT, waypoints[k], 0.0));
+        mission_item_target_.push_back(-1);
+    }
+}
+
+/* build the mission like the OFFBOARD flight: takeoff, each setpoint (with a drop down to z_delivery
+   and back in delivery mode), hover at the final setpoint, return home, and NAV_LAND when the
+   landing is not done in OFFBOARD */
+void OffboardControl::buildMission(std::vector<mavros_msgs::Waypoint> &items) {
+    items.clear();
+    mission_item_target_.clear();
+    Eigen::Vector3d previous = currentPosition();
+    previous.z() = std::max(z_takeoff_, previous.z());
+    items.push_back(missionItem(mavros_msgs::CommandCode::NAV_TAKEOFF, previous, 0.0));
+    mission_item_target_.push_back(-1);
+
+    Eigen::Vector3d setpoint = previous;
+    if (returning_home_) {
+        // resumed after the final setpoint: only the return home and landing are left
+        setpoint << x_target_[num_of_enu_target_ - 1], y_target_[num_of_enu_target_ - 1], z_target_[num_of_enu_target_ - 1];
+    }
+    for (int i = returning_home_ ? num_of_enu_target_ : start_target_; i < num_of_enu_target_; i++) {
+        setpoint << x_target_[i], y_target_[i], z_target_[i];
+        const bool final_target = (i == num_of_enu_target_ - 1);
+        const bool drop = delivery_mode_enable_ && (!final_target || return_home_mode_enable_);
+        appendMissionLeg(items, previous, setpoint);
+        items.push_back(missionItem(mavros_msgs::CommandCode::NAV_WAYPOINT, setpoint, final_target ? hover_time_ : 0.0));
+        mission_item_target_.push_back(drop ? -1 : i);
+        if (drop) {
+            items.push_back(missionItem(mavros_msgs::CommandCode::NAV_WAYPOINT, Eigen::Vector3d(setpoint.x(), setpoint.y(), z_delivery_), unpack_time_));
+            mission_item_target_.push_back(-1);
+            items.push_back(missionItem(mavros_msgs::CommandCode::NAV_WAYPOINT, setpoint, 0.0));
+            mission_item_target_.push_back(i);
+        }
+        previous = setpoint;
+    }
+
+    Eigen::Vector3d land_position(setpoint.x(), setpoint.y(), home_enu_pose_.pose.position.z);
+    if (return_home_mode_enable_) {
+        const Eigen::Vector3d home(home_enu_pose_.pose.position.x, home_enu_pose_.pose.position.y, setpoint.z());
+        appendMissionLeg(items, previous, home);
+        items.push_back(missionItem(mavros_msgs::CommandCode::NAV_WAYPOINT, home, 0.0));
+        mission_item_target_.push_back(-1);
+        land_position << home.x(), home.y(), home_enu_pose_.pose.position.z;
+    }
+    if (!precision_landing_) {
+        items.push_back(missionItem(mavros_msgs::CommandCode::NAV_LAND, land_position, 0.0));
+        mission_item_target_.push_back(-1);
+    }
+    items.front().is_current = true;
+}
+
+/* clear the FCU mission and push the new one
+   input: mission items */
+bool OffboardControl::uploadMission(const std::vector<mavros_msgs::Waypoint> &items) {
+    mavros_msgs::WaypointClear clear;
+    if (!mission_clear_client_.call(clear) || !clear.response.success) {
+        std::printf("[ WARN] Can not clear the FCU mission\n");
+    }
+    mavros_msgs::WaypointPush push;
+    push.request.start_index = 0;
+    push.request.waypoints = items;
+    if (!mission_push_client_.call(push) || !push.response.success) {
+        std::printf("[ WARN] Can not upload the mission (%zu items)\n", items.size());
+        return false;
+    }
+    std::printf("\n[ INFO] Uploaded %u mission items\n", push.response.wp_transfered);
+    return true;
+}
+
+/* fly the setpoints as an FCU mission: upload, wait for ARM and AUTO.MISSION, follow the reached items
+   (checkpoint after each setpoint) and land, in OFFBOARD with the descent profile when precision_landing is set.
+   returns false when the mission could not be uploaded, the caller then flies in OFFBOARD */
+bool OffboardControl::missionFlight() {
+    ros::Rate rate(10.0);
+    std::vector<mavros_msgs::Waypoint> items;
+    buildMission(items);
+    if (!uploadMission(items)) {
+        std::printf("[ WARN] Mission upload failed, flying the setpoints in OFFBOARD\n");
+        return false;
+    }
+
+    mission_reached_seq_ = -1;
+    std::printf("\n[ INFO] Waiting for ARM and AUTO.MISSION\n");
+    while (running() && !(current_state_.armed && current_state_.mode == "AUTO.MISSION")) {
+        if (simulation_mode_enable_) {
+            mavros_msgs::CommandBool arm_cmd;
+            arm_cmd.request.value = true;
+            if (!current_state_.armed) {
+                arming_client_.call(arm_cmd);
+            }
+            flight_mode_.request.custom_mode = "AUTO.MISSION";
+            watchdog_.setMode(set_mode_client_, flight_mode_);
+        }
+        spinOnce();
+        sleepTick(rate);
+    }
+
+    const int last = static_cast<int>(items.size()) - 1;
+    int processed = -1;
+    while (running()) {
+        while (processed < mission_reached_seq_ && processed < last) {
+            processed++;
+            const int target = mission_item_target_[processed];
+            if (target >= 0) {
+                OFFBOARD_LOG("\n[ INFO] Reached position: [%.1f, %.1f, %.1f]\n", x_target_[target], y_target_[target], z_target_[target]);
+                if (delivery_mode_enable_ && (target < num_of_enu_target_ - 1 || return_home_mode_enable_)) {
+                    deliveries_completed_++;
+                }
+                if (target + 1 < num_of_enu_target_) {
+                    saveCheckpoint(target + 1);
+                }
+                else if (return_home_mode_enable_) {
+                    saveCheckpoint(target, true);
+                }
+            }
+        }
+        if (precision_landing_ ? (processed >= last) : !current_state_.armed) {
+            break;
+        }
+        if (current_state_.mode != "AUTO.MISSION") {
+            // pilot or FCU failsafe took over, the checkpoint is kept for a resume
+            OFFBOARD_LOG("\n[ WARN] Mission interrupted, FCU left AUTO.MISSION\n");
+            requestStop();
+            return true;
+        }
+        spinOnce();
+        sleepTick(rate);
+    }
+    if (!running()) {
+        return true;
+    }
+    if (!precision_landing_) {
+        OFFBOARD_LOG("\n[ INFO] LANDED\n");
+        operation_time_2_ = ros::Time::now();
+        OFFBOARD_LOG("\n[ INFO] Operation time %.1f (s)\n\n", (operation_time_2_ - operation_time_1_).toSec());
+        finishMission(true);
+        return true;
+    }
+
+    // precision landing in OFFBOARD
+    setOffboardStream(10.0, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z));
+    offboard_setmode_.request.base_mode = 0;
+    offboard_setmode_.request.custom_mode = "OFFBOARD";
+    if (!watchdog_.setMode(set_mode_client_, offboard_setmode_) || !offboard_setmode_.response.mode_sent) {
+        OFFBOARD_LOG("[ WARN] Failed to set OFFBOARD for landing\n");
+    }
+    watchdog_.setActive(running());
+    deadline_monitor_.reset();
+    if (return_home_mode_enable_) {
+        landing(home_enu_pose_);
+    }
+    else {
+        const int n = num_of_enu_target_ - 1;
+        landingAtMarker(Eigen::Vector3d(x_target_[n], y_target_[n], z_target_[n]));
+    }
+    return true;
+}
+
+void OffboardControl::remainingRoute(DeliveryRoute &route) {
+    fillRoute(route, target_ids_, x_target_, y_target_, z_target_, current_target_, num_of_enu_target_);
+}
+
+void fillRoute(DeliveryRoute &route, const std::vector<int> &ids, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int first, int last) {
+    route.clear();
+    for (int k = first; k < last; k++) {
+        DeliveryStop stop;
+        stop.id = ids[k];
+        stop.position << x[k], y[k], z[k];
+        route.push_back(stop);
+    }
+}
+
+void OffboardControl::applyRoute(const DeliveryRoute &route) {
+    num_of_enu_target_ = current_target_ + static_cast<int>(route.size());
+    x_target_.resize(num_of_enu_target_);
+    y_target_.resize(num_of_enu_target_);
+    z_target_.resize(num_of_enu_target_);
+    target_ids_.resize(num_of_enu_target_);
+    for (size_t k = 0; k < route.size(); k++) {
+        x_target_[current_target_ + k] = route[k].position.x();
+        y_target_[current_target_ + k] = route[k].position.y();
+        z_target_[current_target_ + k] = route[k].position.z();
+        target_ids_[current_target_ + k] = route[k].id;
+    }
+    route_changed_ = true;
+    saveCheckpoint(current_target_);
+    publishEtas();
+}
+
+double OffboardControl::deliveryServiceTime() {
+    if (!delivery_mode_enable_) {
+        return 0.0;
+    }
+    const double climb = std::max(z_target_[current_target_] - z_delivery_, 0.0);
+    return unpack_time_ + climb / std::max(land_vel_, 0.1) + climb / std::max(vel_desired_, 0.1);
+}
+
+void OffboardControl::publishEtas() {
+    if (current_target_ >= num_of_enu_target_) {
+        return;
+    }
+    // called from the flight loop every 10 ticks: route, ETAs and message are members reserved at mission start
+    remainingRoute(eta_route_);
+    delivery_planner_.etas(currentPosition(), eta_route_, vel_desired_, deliveryServiceTime(), eta_);
+    fillDeliveryEtas(etas_msg_, eta_route_, eta_, ros::Time::now());
+    delivery_etas_pub_.publish(etas_msg_);
+}
+
+void fillDeliveryEtas(offboard::DeliveryEtas &msg, const DeliveryRoute &route, const std::vector<double> &eta, const ros::Time &stamp) {
+    msg.header.stamp = stamp;
+    msg.ids.clear();
+    msg.positions.clear();
+    msg.eta.clear();
+    for (size_t k = 0; k < route.size(); k++) {
+        geometry_msgs::Point position;
+        position.x = route[k].position.x();
+        position.y = route[k].position.y();
+        position.z = route[k].position.z();
+        msg.ids.push_back(route[k].id);
+        msg.positions.push_back(position);
+        msg.eta.push_back(eta[k]);
+    }
+}
+
+/* add a delivery point in flight: cheapest insertion before the final setpoint, then the remaining
+   order is improved within delivery_budget_ms. Served between two ticks of the flight loop */
+bool OffboardControl::addDeliveryCallback(offboard::AddDelivery::Request &req, offboard::AddDelivery::Response &res) {
+    const ros::WallTime t_start = ros::WallTime::now();
+    if (!route_active_) {
+        res.success = false;
+        res.message = "setpoints can only be added during the OFFBOARD flight";
+        return true;
+    }
+    DeliveryStop stop;
+    stop.id = next_target_id_;
+    stop.position << req.position.x, req.position.y, (req.position.z > 0.0) ? req.position.z : z_target_[current_target_];
+    if (map_enable_ && !spatial_map_.pointFree(stop.position)) {
+        res.success = false;
+        res.message = "setpoint is inside an obstacle or geofence";
+        return true;
+    }
+    DeliveryRoute route;
+    remainingRoute(route);
+    delivery_planner_.rebuild(route);
+    const Eigen::Vector3d current = currentPosition();
+    const int index = delivery_planner_.insert(current, route, stop, delivering_ ? 1 : 0);
+    const double planning_ms = (ros::WallTime::now() - t_start).toSec() * 1e3;
+    next_target_id_++;
+    applyRoute(route);
+
+    std::vector<double> eta;
+    delivery_planner_.etas(current, route, vel_desired_, deliveryServiceTime(), eta);
+    res.success = true;
+    res.id = stop.id;
+    res.eta = eta[index];
+    // the whole callback runs between two control ticks, not only the planner
+    OFFBOARD_LOG("\n[ INFO] Added delivery %d [%.1f, %.1f, %.1f] at position %d, ETA %.1f (s), planned in %.2f (ms), served in %.2f (ms)\n", stop.id,
+                 stop.position.x(), stop.position.y(), stop.position.z(), index + 1, res.eta, planning_ms, (ros::WallTime::now() - t_start).toSec() * 1e3);
+    return true;
+}
+
+bool OffboardControl::cancelDeliveryCallback(offboard::CancelDelivery::Request &req, offboard::CancelDelivery::Response &res) {
+    const ros::WallTime t_start = ros::WallTime::now();
+    if (!route_active_) {
+        res.success = false;
+        res.message = "setpoints can only be cancelled during the OFFBOARD flight";
+        return true;
+    }
+    DeliveryRoute route;
+    remainingRoute(route);
+    if (!delivery_planner_.cancel(route, req.id, delivering_ ? 1 : 0)) {
+        res.success = false;
+        res.message = "no pending setpoint with this id (the final setpoint and the one being delivered can not be cancelled)";
+        return true;
+    }
+    applyRoute(route);
+    res.success = true;
+    OFFBOARD_LOG("\n[ INFO] Cancelled delivery %d, served in %.2f (ms)\n", req.id, (ros::WallTime::now() - t_start).toSec() * 1e3);
+    return true;
+}
+
+/* store mission progress so an interrupted mission can be resumed
+   called from the flight loops and services: checkpoint_ is posted to checkpoint_writer_, which syncs it to storage
+   input: index of the next unvisited setpoint, every setpoint is done and the vehicle returns home */
+void OffboardControl::saveCheckpoint(int next_target, bool returning_home) {
+    if (!checkpoint_file_.enabled() || !running()) {
+        // loops return early after a stop or failsafe, progress reported then is not real
+        return;
+    }
+    MissionCheckpoint &checkpoint = checkpoint_;
+    checkpoint.setTargets(x_target_, y_target_, z_target_, num_of_enu_target_);
+    checkpoint.next_target = next_target;
+    checkpoint.deliveries_completed = deliveries_completed_;
+    checkpoint.returning_home = returning_home;
+    checkpoint.home_x = home_enu_pose_.pose.position.x;
+    checkpoint.home_y = home_enu_pose_.pose.position.y;
+    checkpoint.home_z = home_enu_pose_.pose.position.z;
+    checkpoint.home_qx = home_enu_pose_.pose.orientation.x;
+    checkpoint.home_qy = home_enu_pose_.pose.orientation.y;
+    checkpoint.home_qz = home_enu_pose_.pose.orientation.z;
+    checkpoint.home_qw = home_enu_pose_.pose.orientation.w;
+    checkpoint.home_latitude = home_gps_position_.latitude;
+    checkpoint.home_longitude = home_gps_position_.longitude;
+    checkpoint.home_altitude = home_gps_position_.altitude;
+    checkpoint.ref_latitude = ref_gps_position_.latitude;
+    checkpoint.ref_longitude = ref_gps_position_.longitude;
+    checkpoint.ref_altitude = ref_gps_position_.altitude;
+    checkpoint.x_offset = x_offset_;
+    checkpoint.y_offset = y_offset_;
+    checkpoint.z_offset = z_offset_;
+    checkpoint_writer_.post(checkpoint);
+}
+
+/* restore setpoints, progress, home and offsets from the checkpoint, skipping input and waitForStable */
+bool OffboardControl::resumeFromCheckpoint() {
+    MissionCheckpoint checkpoint;
+    if (!checkpoint_file_.load(checkpoint)) {
+        std::printf("\n[ WARN] No mission checkpoint to resume, starting a new mission\n");
+        return false;
+    }
+    x_target_ = checkpoint.x_target;
+    y_target_ = checkpoint.y_target;
+    z_target_ = checkpoint.z_target;
+    num_of_enu_target_ = x_target_.size();
+    start_target_ = checkpoint.next_target;
+    deliveries_completed_ = checkpoint.deliveries_completed;
+    returning_home_ = checkpoint.returning_home && return_home_mode_enable_;
+    home_enu_pose_ = targetTransfer(checkpoint.home_x, checkpoint.home_y, checkpoint.home_z);
+    home_enu_pose_.pose.orientation.x = checkpoint.home_qx;
+    home_enu_pose_.pose.orientation.y = checkpoint.home_qy;
+    home_enu_pose_.pose.orientation.z = checkpoint.home_qz;
+    home_enu_pose_.pose.orientation.w = checkpoint.home_qw;
+    home_gps_position_.latitude = checkpoint.home_latitude;
+    home_gps_position_.longitude = checkpoint.home_longitude;
+    home_gps_position_.altitude = checkpoint.home_altitude;
+    ref_gps_position_.latitude = checkpoint.ref_latitude;
+    ref_gps_position_.longitude = checkpoint.ref_longitude;
+    ref_gps_position_.altitude = checkpoint.ref_altitude;
+    x_offset_ = checkpoint.x_offset;
+    y_offset_ = checkpoint.y_offset;
+    z_offset_ = checkpoint.z_offset;
+    // setpoints are stored in the odometry frame of the interrupted flight, the drift since then is tracked again
+    drift_estimator_.start(ref_gps_position_, Eigen::Vector3d(x_offset_, y_offset_, z_offset_));
+
+    if (returning_home_) {
+        std::printf("\n[ INFO] Resuming mission at return home (%d deliveries done)\n", deliveries_completed_);
+    }
+    else {
+        std::printf("\n[ INFO] Resuming mission at target %d of %d (%d deliveries done)\n", start_target_ + 1, num_of_enu_target_, deliveries_completed_);
+    }
+    std::printf("        HOME position: [%.1f, %.1f, %.1f]\n", home_enu_pose_.pose.position.x, home_enu_pose_.pose.position.y, home_enu_pose_.pose.position.z);
+    operation_time_1_ = ros::Time::now();
+    return true;
+}
+
 /* transfer x, y, z setpoint to same message type with enu setpoint msg
    input: x, y, z that want to create geometry_msgs::PoseStamped msg */
 geometry_msgs::PoseStamped OffboardControl::targetTransfer(double x, double y, double z) {
@@ -423,258 +1111,320 @@ geometry_msgs::PoseStamped OffboardControl::targetTransfer(double x, double y, d
 
 
 /* calculate distance between current position and setpoint position
-   input: current and target poses (ENU) to calculate distance */
-double OffboardControl::distanceBetween(geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target) {
-    Eigen::Vector3d distance;
-    distance << target.pose.position.x - current.pose.position.x,
-        target.pose.position.y - current.pose.position.y,
-        target.pose.position.z - current.pose.position.z;
-
-    return distance.norm();
+   input: current and target positions (ENU) to calculate distance */
+double OffboardControl::distanceBetween(const Eigen::Vector3d &current, const Eigen::Vector3d &target) {
+    return (target - current).norm();
 }
 
 /* calculate components of velocity about x, y, z axis
-   input: desired velocity, current and target poses (ENU) */
-geometry_msgs::Vector3 OffboardControl::velComponentsCalc(double v_desired, geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped target) {
-    double xc = current.pose.position.x;
-    double yc = current.pose.position.y;
-    double zc = current.pose.position.z;
-
-    double xt = target.pose.position.x;
-    double yt = target.pose.position.y;
-    double zt = target.pose.position.z;
-
-    double dx = xt - xc;
-    double dy = yt - yc;
-    double dz = zt - zc;
-
-    double d = sqrt(sqr(dx) + sqr(dy) + sqr(dz));
-
-    geometry_msgs::Vector3 vel;
-
-    vel.x = ((dx / d) * v_desired);
-    vel.y = ((dy / d) * v_desired);
-    vel.z = ((dz / d) * v_desired);
-
-    return vel;
+   input: desired velocity, current and target positions (ENU) */
+Eigen::Vector3d OffboardControl::velComponentsCalc(double v_desired, const Eigen::Vector3d &current, const Eigen::Vector3d &target) {
+    return velocityTowards(v_desired, current, target);
 }
 
 
 /* calculate yaw offset between current position and next optimization position */
-double OffboardControl::calculateYawOffset(geometry_msgs::PoseStamped current, geometry_msgs::PoseStamped setpoint) {
-    double alpha;
-    double xc = current.pose.position.x;
-    double yc = current.pose.position.y;
-    double xs = setpoint.pose.position.x;
-    double ys = setpoint.pose.position.y;
+double OffboardControl::calculateYawOffset(const Eigen::Vector3d &current, const Eigen::Vector3d &setpoint) {
+    return bearingTo(current, setpoint);
+}
 
-    alpha = atan2(abs(ys - yc), abs(xs - xc));
-    if ((xs > xc) && (ys > yc)) {
-        return alpha;
-    }
-    else if ((xs < xc) && (ys > yc)) {
-        return (PI - alpha);
-    }
-    else if ((xs < xc) && (ys < yc)) {
-        return (alpha - PI);
-    }
-    else if ((xs > xc) && (ys < yc)) {
-        return (-alpha);
-    }
-    else if ((xs == xc) && (ys > yc)) {
-        return alpha;
-    }
-    else if ((xs == xc) && (ys < yc)) {
-        return (-alpha);
-    }
-    else if ((xs > xc) && (ys == yc)) {
-        return alpha;
-    }
-    else if ((xs < xc) && (ys == yc)) {
-        return (PI - alpha);
-    }
-    else {
-        return alpha;
+/* fill target_enu_pose_ in place and publish it, so a control tick builds no new message
+   input: ENU position and orientation of the setpoint */
+void OffboardControl::publishTarget(const Eigen::Vector3d &position, const geometry_msgs::Quaternion &orientation) {
+    if (watchdog_.tripped()) {
+        return; // the FCU is in failsafe mode, do not stream carrots from a frozen pose
     }
+    fillTargetPose(target_enu_pose_, position, orientation, ros::Time::now());
+    setpoint_pose_pub_.publish(target_enu_pose_);
+}
+
+void fillTargetPose(geometry_msgs::PoseStamped &pose, const Eigen::Vector3d &position, const geometry_msgs::Quaternion &orientation, const ros::Time &stamp) {
+    pose.pose.position.x = position.x();
+    pose.pose.position.y = position.y();
+    pose.pose.position.z = position.z();
+    pose.pose.orientation = orientation;
+    pose.header.stamp = stamp;
 }
 
 
 /* perform takeoff task
    input: setpoint to takeoff and hover time */
-void OffboardControl::takeOff(geometry_msgs::PoseStamped setpoint, double hover_time) {
+void OffboardControl::takeOff(const geometry_msgs::PoseStamped &setpoint, double hover_time) {
     ros::Rate rate(10.0);
-    std::printf("\n[ INFO] Takeoff to [%.1f, %.1f, %.1f]\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z);
+    OFFBOARD_LOG("\n[ INFO] Takeoff to [%.1f, %.1f, %.1f]\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z);
+    const Eigen::Vector3d takeoff_position = positionOf(setpoint.pose.position);
+    const geometry_msgs::Quaternion no_orientation;
+    Eigen::Vector3d current;
     bool takeoff_reached = false;
-    while (ros::ok() && !takeoff_reached) {
-        components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
+    leg_guard_.reset(currentPosition());
+    while (running() && !takeoff_reached) {
+        current = currentPosition();
+        components_vel_ = velComponentsCalc(vel_desired_, current, leg_guard_.waypoint(current, takeoff_position));
+        publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), no_orientation);
 
-        target_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x + components_vel_.x, current_odom_.pose.pose.position.y + components_vel_.y, current_odom_.pose.pose.position.z + components_vel_.z);
-        target_enu_pose_.header.stamp = ros::Time::now();
-        setpoint_pose_pub_.publish(target_enu_pose_);
-
-        takeoff_reached = checkPositionError(target_error_, setpoint);
+        takeoff_reached = leg_guard_.clear() && checkPositionError(target_error_, takeoff_position);
         if (takeoff_reached) {
             hovering(setpoint, hover_time);
         }
         else {
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
     }
 }
 
 /* perform hover task
    input: setpoint to hover and hover time */
-void OffboardControl::hovering(geometry_msgs::PoseStamped setpoint, double hover_time) {
+void OffboardControl::hovering(const geometry_msgs::PoseStamped &setpoint, double hover_time) {
     ros::Rate rate(10.0);
     ros::Time t_check;
 
-    std::printf("\n[ INFO] Hovering at [%.1f, %.1f, %.1f] in %.1f (s)\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z, hover_time);
+    OFFBOARD_LOG("\n[ INFO] Hovering at [%.1f, %.1f, %.1f] in %.1f (s)\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z, hover_time);
     t_check = ros::Time::now();
-    while ((ros::Time::now() - t_check) < ros::Duration(hover_time)) {
-        setpoint_pose_pub_.publish(setpoint);
+    while (running() && (ros::Time::now() - t_check) < ros::Duration(hover_time)) {
+        publishTarget(positionOf(setpoint.pose.position), setpoint.pose.orientation);
+
+        spinOnce();
+        sleepTick(rate);
+    }
+}
+
+bool OffboardControl::markerVisible() {
+    return !marker_stamp_.isZero() && (ros::Time::now() - marker_stamp_).toSec() < marker_timeout_;
+}
+
+/* fly an expanding square around center until the marker detector reports the target marker
+   input: center of the search (final setpoint), output: marker position in ENU
+   the altitude is raised (up to search_max_altitude) so the pattern covers search_radius in
+   search_max_rings rings; the search stops on the first tick after a detection arrives */
+bool OffboardControl::searchMarker(const Eigen::Vector3d &center, Eigen::Vector3d &marker) {
+    ros::Rate rate(land_rate_);
+    spinOnce();
+    if (!markerVisible()) {
+        const double altitude = search_pattern_.altitudeFor(search_radius_, search_max_rings_, center.z(), search_max_altitude_);
+        std::vector<Eigen::Vector3d> waypoints;
+        search_pattern_.expandingSquare(Eigen::Vector3d(center.x(), center.y(), altitude), search_radius_, waypoints);
+        // climb above the center first, then fly the legs
+        waypoints.insert(waypoints.begin(), Eigen::Vector3d(center.x(), center.y(), altitude));
+        if (map_enable_) {
+            // pattern corners inside obstacles or geofences are skipped, the legs between the others are validated
+            waypoints.erase(std::remove_if(waypoints.begin(), waypoints.end(),
+                                           [this](const Eigen::Vector3d &w) { return !spatial_map_.pointFree(w); }), waypoints.end());
+        }
+        OFFBOARD_LOG("\n[ INFO] Marker not in view, searching %zu waypoints at %.1f (m), footprint %.1f x %.1f (m)\n", waypoints.size(), altitude,
+                     search_pattern_.footprintWidth(altitude), search_pattern_.footprintHeight(altitude));
+
+        const geometry_msgs::Quaternion no_orientation;
+        const ros::Time t_start = ros::Time::now();
+        Eigen::Vector3d current;
+        size_t k = 0;
+        leg_guard_.reset(currentPosition());
+        while (running() && k < waypoints.size() && !markerVisible()) {
+            current = currentPosition();
+            components_vel_ = velComponentsCalc(search_velocity_, current, leg_guard_.waypoint(current, waypoints[k]));
+            publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), no_orientation);
+            if (leg_guard_.clear() && checkPositionError(target_error_, waypoints[k])) {
+                k++;
+            }
+            spinOnce();
+            sleepTick(rate);
+        }
+        if (!markerVisible()) {
+            OFFBOARD_LOG("\n[ WARN] Marker not found\n");
+            return false;
+        }
+        OFFBOARD_LOG("\n[ INFO] Marker acquired after %.1f (s)\n", (ros::Time::now() - t_start).toSec());
+    }
+    marker = positionOf(marker_position_.pose.position);
+    return true;
+}
 
-        ros::spinOnce();
-        rate.sleep();
+/* final landing: on the marker when marker landing is enabled and it is found, at the setpoint otherwise
+   input: final setpoint */
+void OffboardControl::landingAtMarker(const Eigen::Vector3d &setpoint) {
+    Eigen::Vector3d marker;
+    if (marker_landing_enable_ && searchMarker(setpoint, marker)) {
+        OFFBOARD_LOG("[ INFO] Landing on marker [%.1f, %.1f]\n", marker.x(), marker.y());
+        landingYaw(targetTransfer(marker.x(), marker.y(), 0.0, degreeOf(yaw_)));
+    }
+    else {
+        landingYaw(targetTransfer(setpoint.x(), setpoint.y(), 0.0, degreeOf(yaw_)));
     }
 }
 
 /* perform land task
    input: set point to land (e.g., [x, y, 0.0]) */
-void OffboardControl::landing(geometry_msgs::PoseStamped setpoint) {
-    ros::Rate rate(10.0);
+void OffboardControl::landing(const geometry_msgs::PoseStamped &setpoint) {
+    ros::Rate rate(land_rate_);
+    const Eigen::Vector3d land_position = positionOf(setpoint.pose.position);
+    const geometry_msgs::Quaternion no_orientation;
+    Eigen::Vector3d current;
     bool land_reached = false;
-    std::printf("[ INFO] Landing\n");
-    while (ros::ok() && !land_reached) {
-        components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
-
-        target_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x + components_vel_.x, current_odom_.pose.pose.position.y + components_vel_.y, current_odom_.pose.pose.position.z + components_vel_.z);
-        target_enu_pose_.header.stamp = ros::Time::now();
-        // target_enu_pose_.pose.orientation = setpoint.pose.orientation;
-        setpoint_pose_pub_.publish(target_enu_pose_);
+    bool landed = false;
+    OFFBOARD_LOG("[ INFO] Landing\n");
+    startDescent(land_position.z());
+    leg_guard_.reset(currentPosition());
+    while (running() && !land_reached) {
+        current = currentPosition();
+        components_vel_ = velComponentsCalc(descent_profile_.velocity(heightAboveGround()), current, leg_guard_.waypoint(current, land_position));
+        publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), no_orientation);
 
-        land_reached = checkPositionError(land_error_, setpoint);
+        land_reached = (leg_guard_.clear() && checkPositionError(land_error_, land_position)) || touchdown_detected_;
 
         if (current_state_.system_status == 3) {
-            std::printf("\n[ INFO] Land detected\n");
+            OFFBOARD_LOG("\n[ INFO] Land detected\n");
             flight_mode_.request.custom_mode = "AUTO.LAND";
-            if (set_mode_client_.call(flight_mode_) && flight_mode_.response.mode_sent) {
+            if (watchdog_.setMode(set_mode_client_, flight_mode_) && flight_mode_.response.mode_sent) {
+                landed = true;
                 break;
             }
         }
         else if (land_reached) {
+            if (touchdown_detected_) {
+                OFFBOARD_LOG("\n[ INFO] Touchdown detected\n");
+            }
+            landed = touchdown_detected_;
             flight_mode_.request.custom_mode = "AUTO.LAND";
-            if (set_mode_client_.call(flight_mode_) && flight_mode_.response.mode_sent) {
-                std::printf("\n[ INFO] LANDED\n");
+            if (watchdog_.setMode(set_mode_client_, flight_mode_) && flight_mode_.response.mode_sent) {
+                OFFBOARD_LOG("\n[ INFO] LANDED\n");
+                landed = true;
             }
         }
         else {
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
     }
 
+    touchdown_armed_ = false;
     operation_time_2_ = ros::Time::now();
-    std::printf("\n[ INFO] Operation time %.1f (s)\n\n", (operation_time_2_ - operation_time_1_).toSec());
-    ros::shutdown();
+    OFFBOARD_LOG("\n[ INFO] Operation time %.1f (s)\n\n", (operation_time_2_ - operation_time_1_).toSec());
+    finishMission(landed);
 }
 
-void OffboardControl::landingYaw(geometry_msgs::PoseStamped setpoint) {
-    ros::Rate rate(10.0);
+void OffboardControl::landingYaw(const geometry_msgs::PoseStamped &setpoint) {
+    ros::Rate rate(land_rate_);
+    const Eigen::Vector3d land_position = positionOf(setpoint.pose.position);
+    Eigen::Vector3d current;
     bool land_reached = false;
-    std::printf("[ INFO] Landing\n");
-    while (ros::ok() && !land_reached) {
-        components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), setpoint);
+    bool landed = false;
+    OFFBOARD_LOG("[ INFO] Landing\n");
+    startDescent(land_position.z());
+    leg_guard_.reset(currentPosition());
+    while (running() && !land_reached) {
+        current = currentPosition();
+        components_vel_ = velComponentsCalc(descent_profile_.velocity(heightAboveGround()), current, leg_guard_.waypoint(current, land_position));
+        publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), setpoint.pose.orientation);
 
-        target_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x + components_vel_.x, current_odom_.pose.pose.position.y + components_vel_.y, current_odom_.pose.pose.position.z + components_vel_.z, setpoint.pose.orientation);
-        target_enu_pose_.header.stamp = ros::Time::now();
-        // target_enu_pose_.pose.orientation = setpoint.pose.orientation;
-        setpoint_pose_pub_.publish(target_enu_pose_);
-
-        land_reached = checkPositionError(land_error_, setpoint);
+        land_reached = (leg_guard_.clear() && checkPositionError(land_error_, land_position)) || touchdown_detected_;
 
         if (current_state_.system_status == 3) {
-            std::printf("\n[ INFO] Land detected\n");
+            OFFBOARD_LOG("\n[ INFO] Land detected\n");
             flight_mode_.request.custom_mode = "AUTO.LAND";
-            if (set_mode_client_.call(flight_mode_) && flight_mode_.response.mode_sent) {
+            if (watchdog_.setMode(set_mode_client_, flight_mode_) && flight_mode_.response.mode_sent) {
+                landed = true;
                 break;
             }
         }
         else if (land_reached) {
+            if (touchdown_detected_) {
+                OFFBOARD_LOG("\n[ INFO] Touchdown detected\n");
+            }
+            landed = touchdown_detected_;
             flight_mode_.request.custom_mode = "AUTO.LAND";
-            if (set_mode_client_.call(flight_mode_) && flight_mode_.response.mode_sent) {
-                std::printf("\n[ INFO] LANDED\n");
+            if (watchdog_.setMode(set_mode_client_, flight_mode_) && flight_mode_.response.mode_sent) {
+                OFFBOARD_LOG("\n[ INFO] LANDED\n");
+                landed = true;
             }
         }
         else {
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
     }
 
+    touchdown_armed_ = false;
     operation_time_2_ = ros::Time::now();
-    std::printf("\n[ INFO] Operation time %.1f (s)\n\n", (operation_time_2_ - operation_time_1_).toSec());
-    ros::shutdown();
+    OFFBOARD_LOG("\n[ INFO] Operation time %.1f (s)\n\n", (operation_time_2_ - operation_time_1_).toSec());
+    finishMission(landed);
 }
 
 /* perform return home task
    input: home pose in ENU (e.g., [home x, home y, 10.0])*/
-void OffboardControl::returnHome(geometry_msgs::PoseStamped home_pose) {
+void OffboardControl::returnHome(const geometry_msgs::PoseStamped &home_pose) {
     ros::Rate rate(10.0);
+    const Eigen::Vector3d home_position = positionOf(home_pose.pose.position);
+    const geometry_msgs::Quaternion no_orientation;
+    Eigen::Vector3d current;
     bool home_reached = false;
-    while (ros::ok() && !home_reached) {
-        components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), home_pose);
-
-        target_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x + components_vel_.x, current_odom_.pose.pose.position.y + components_vel_.y, current_odom_.pose.pose.position.z + components_vel_.z);
-        target_enu_pose_.header.stamp = ros::Time::now();
-        setpoint_pose_pub_.publish(target_enu_pose_);
+    leg_guard_.reset(currentPosition());
+    while (running() && !home_reached) {
+        current = currentPosition();
+        components_vel_ = velComponentsCalc(vel_desired_, current, leg_guard_.waypoint(current, home_position));
+        publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), no_orientation);
 
-        home_reached = checkPositionError(target_error_, home_pose);
+        home_reached = leg_guard_.clear() && checkPositionError(target_error_, home_position);
         if (home_reached) {
             hovering(home_pose, hover_time_);
         }
         else {
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
     }
 }
 
+/* return home at the altitude of the final setpoint and land there
+   input: altitude of the return leg (ENU z) */
+void OffboardControl::returnHomeAndLand(double altitude) {
+    const Eigen::Vector3d home = driftCorrected(positionOf(home_enu_pose_.pose.position));
+    OFFBOARD_LOG("\n[ INFO] Returning home [%.1f, %.1f, %.1f]\n", home.x(), home.y(), home.z());
+    returnHome(targetTransfer(home.x(), home.y(), altitude));
+    landing(targetTransfer(home.x(), home.y(), home.z()));
+}
+
 /* perform delivery task
    input: current setpoint in trajectory and time to unpack */
-void OffboardControl::delivery(geometry_msgs::PoseStamped setpoint, double unpack_time) {
-    ros::Rate rate(10.0);
+void OffboardControl::delivery(const geometry_msgs::PoseStamped &setpoint, double unpack_time) {
+    ros::Rate rate(land_rate_);
+    const Eigen::Vector3d drop_position(setpoint.pose.position.x, setpoint.pose.position.y, z_delivery_);
+    const geometry_msgs::Quaternion no_orientation;
+    Eigen::Vector3d current;
     bool land_reached = false;
-    std::printf("[ INFO] Land for unpacking\n");
-    while (ros::ok() && !land_reached) {
-        components_vel_ = velComponentsCalc(vel_desired_, targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), targetTransfer(setpoint.pose.position.x, setpoint.pose.position.y, z_delivery_));
-
-        target_enu_pose_ = targetTransfer(current_odom_.pose.pose.position.x + components_vel_.x, current_odom_.pose.pose.position.y + components_vel_.y, current_odom_.pose.pose.position.z + components_vel_.z);
-        target_enu_pose_.header.stamp = ros::Time::now();
-        setpoint_pose_pub_.publish(target_enu_pose_);
-
-        if (current_state_.system_status == 3) {
+    OFFBOARD_LOG("[ INFO] Land for unpacking\n");
+    // ground is assumed at the home altitude, the descent slows down above the drop height
+    startDescent(home_enu_pose_.pose.position.z);
+    const double drop_height = z_delivery_ - ground_z_;
+    leg_guard_.reset(currentPosition());
+    while (running() && !land_reached) {
+        current = currentPosition();
+        components_vel_ = velComponentsCalc(descent_profile_.velocity(heightAboveGround() - drop_height), current, leg_guard_.waypoint(current, drop_position));
+        publishTarget(leg_guard_.checkedCarrot(current, current + components_vel_), no_orientation);
+
+        if (current_state_.system_status == 3 || touchdown_detected_) {
             land_reached = true;
         }
         else {
-            land_reached = checkPositionError(land_error_, targetTransfer(setpoint.pose.position.x, setpoint.pose.position.y, z_delivery_));
+            land_reached = leg_guard_.clear() && checkPositionError(land_error_, drop_position);
         }
 
         if (land_reached) {
-            if (current_state_.system_status == 3) {
+            touchdown_armed_ = false;
+            if (current_state_.system_status == 3 || touchdown_detected_) {
+                OFFBOARD_LOG("\n[ INFO] Touchdown detected\n");
                 hovering(targetTransfer(current_odom_.pose.pose.position.x, current_odom_.pose.pose.position.y, current_odom_.pose.pose.position.z), unpack_time);
                 // TODO: unpack service
             }
             else {
-                hovering(targetTransfer(setpoint.pose.position.x, setpoint.pose.position.y, z_delivery_), unpack_time);
+                hovering(targetTransfer(drop_position.x(), drop_position.y(), drop_position.z()), unpack_time);
                 // TODO: unpack service
             }
-            std::printf("\n[ INFO] Done! Return setpoint [%.1f, %.1f, %.1f]\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z);
+            OFFBOARD_LOG("\n[ INFO] Done! Return setpoint [%.1f, %.1f, %.1f]\n", setpoint.pose.position.x, setpoint.pose.position.y, setpoint.pose.position.z);
             returnHome(setpoint);
         }
         else {
-            ros::spinOnce();
-            rate.sleep();
+            spinOnce();
+            sleepTick(rate);
         }
     }
 }
@@ -739,9 +1489,58 @@ geometry_msgs::Point OffboardControl::ECEFToENU(geometry_msgs::Point ecef, senso
     return enu;
 }
 
-bool OffboardControl::checkPositionError(double error, geometry_msgs::PoseStamped target) {
-    Eigen::Vector3d geo_error;
-    geo_error << target.pose.position.x - current_odom_.pose.pose.position.x, target.pose.position.y - current_odom_.pose.pose.position.y, target.pose.position.z - current_odom_.pose.pose.position.z;
+/* convert from ENU x,y,z to ECEF x,y,z
+   input: point in ENU and reference GPS */
+geometry_msgs::Point OffboardControl::ENUToECEF(geometry_msgs::Point enu, sensor_msgs::NavSatFix ref) {
+    geometry_msgs::Point ecef;
+    double lambda = radianOf(ref.latitude);
+    double phi = radianOf(ref.longitude);
+    double s = sin(lambda);
+    double N = a / sqrt(1 - e_sq * s * s);
+
+    double sin_lambda = sin(lambda);
+    double cos_lambda = cos(lambda);
+    double cos_phi = cos(phi);
+    double sin_phi = sin(phi);
+
+    double x0 = (ref.altitude + N) * cos_lambda * cos_phi;
+    double y0 = (ref.altitude + N) * cos_lambda * sin_phi;
+    double z0 = (ref.altitude + (1 - e_sq) * N) * sin_lambda;
+
+    // transpose of the ECEF to ENU rotation
+    ecef.x = x0 - sin_phi * enu.x - sin_lambda * cos_phi * enu.y + cos_lambda * cos_phi * enu.z;
+    ecef.y = y0 + cos_phi * enu.x - sin_lambda * sin_phi * enu.y + cos_lambda * sin_phi * enu.z;
+    ecef.z = z0 + cos_lambda * enu.y + sin_lambda * enu.z;
+
+    return ecef;
+}
+
+/* convert from ECEF x,y,z to WGS84 GPS (LLA)
+   input: point in ECEF, latitude is refined iteratively (converges to sub-millimeter in a few steps) */
+geographic_msgs::GeoPoint OffboardControl::ECEFToWGS84(geometry_msgs::Point ecef) {
+    geographic_msgs::GeoPoint wgs84;
+    double p = sqrt(ecef.x * ecef.x + ecef.y * ecef.y);
+    double phi = atan2(ecef.y, ecef.x);
+    double lambda = atan2(ecef.z, p * (1 - e_sq));
+    double N = a, h = 0.0;
+    for (int k = 0; k < 5; k++) {
+        double s = sin(lambda);
+        N = a / sqrt(1 - e_sq * s * s);
+        h = p / cos(lambda) - N;
+        lambda = atan2(ecef.z, p * (1 - e_sq * N / (N + h)));
+    }
+    wgs84.latitude = degreeOf(lambda);
+    wgs84.longitude = degreeOf(phi);
+    wgs84.altitude = h;
+    return wgs84;
+}
+
+/* convert from ENU x,y,z to WGS84 GPS (LLA)
+   input: point in ENU and reference GPS */
+geographic_msgs::GeoPoint OffboardControl::ENUToWGS84(geometry_msgs::Point enu, sensor_msgs::NavSatFix ref) {
+    return ECEFToWGS84(ENUToECEF(enu, ref));
+}
 
-    return (geo_error.norm() < error) ? true : false;
+bool OffboardControl::checkPositionError(double error, const Eigen::Vector3d &target) {
+    return ((target - currentPosition()).norm() < error) ? true : false;
 }
@@ -0,0 +1,44 @@
+#include"offboard/offboard.h"
+
+#include<nodelet/nodelet.h>
+#include<pluginlib/class_list_macros.h>
+
+#include<memory>
+#include<thread>
+
+namespace offboard
+{
+
+/* OffboardControl packaged as a nodelet, one instance per vehicle namespace
+   (e.g. /uav0, /uav1). The mission runs in its own thread and services only the
+   callbacks of its vehicle, so several vehicles share one manager process. */
+class OffboardNodelet : public nodelet::Nodelet
+{
+  public:
+	~OffboardNodelet();
+  private:
+	void onInit() override;
+
+	std::unique_ptr<OffboardControl> offboard_; // controller of this vehicle
+	std::thread mission_thread_; // thread running the (blocking) mission loops
+};
+
+OffboardNodelet::~OffboardNodelet() {
+    if (offboard_) {
+        offboard_->requestStop();
+    }
+    if (mission_thread_.joinable()) {
+        mission_thread_.join();
+    }
+}
+
+void OffboardNodelet::onInit() {
+    // setpoints are always loaded from parameters, the keyboard is not available in a manager
+    offboard_.reset(new OffboardControl(getNodeHandle(), getPrivateNodeHandle(), false));
+    mission_thread_ = std::thread(&OffboardControl::runMission, offboard_.get());
+    NODELET_INFO("[ INFO] Offboard mission started in namespace %s", getNodeHandle().getNamespace().c_str());
+}
+
+} // namespace offboard
+
+PLUGINLIB_EXPORT_CLASS(offboard::OffboardNodelet, nodelet::Nodelet)
@@ -0,0 +1,101 @@
+#include "offboard/realtime.h"
+
+#include<cerrno>
+#include<cstdio>
+#include<cstring>
+
+#include<pthread.h>
+#include<sched.h>
+#include<sys/mman.h>
+#include<unistd.h>
+
+namespace
+{
+
+/* touch size bytes of stack so the pages are mapped (and locked) before the control loops run */
+void prefaultStack(size_t size) {
+    const size_t chunk = 4096;
+    volatile unsigned char buffer[chunk];
+    for (size_t k = 0; k < chunk; k += 64) {
+        buffer[k] = 0;
+    }
+    if (size > chunk) {
+        prefaultStack(size - chunk);
+    }
+    buffer[0] = buffer[chunk - 64]; // use the frame after the call, so it is not turned into a loop
+}
+
+} // namespace
+
+bool enterRealtime(const RealtimeConfig &config) {
+    bool ok = true;
+    if (config.lock_memory) {
+        if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            std::printf("[ WARN] mlockall failed: %s\n", std::strerror(errno));
+            ok = false;
+        }
+        prefaultStack(config.stack_prefault);
+    }
+    if (config.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config.cpu, &cpus);
+        int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0) {
+            std::printf("[ WARN] Can not pin control thread to CPU %d: %s\n", config.cpu, std::strerror(err));
+            ok = false;
+        }
+    }
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = config.priority;
+    int err = ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        std::printf("[ WARN] Can not set SCHED_FIFO priority %d: %s\n", config.priority, std::strerror(err));
+        ok = false;
+    }
+    if (ok) {
+        std::printf("[ INFO] Real-time mode: SCHED_FIFO %d, CPU %d, memory %s\n", config.priority, config.cpu, config.lock_memory ? "locked" : "not locked");
+    }
+    return ok;
+}
+
+bool leaveRealtime() {
+    bool ok = true;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    const long count = ::sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++) {
+        CPU_SET(cpu, &cpus);
+    }
+    int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0) {
+        std::printf("[ WARN] Can not reset CPU affinity: %s\n", std::strerror(err));
+        ok = false;
+    }
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    err = ::pthread_setschedparam(::pthread_self(), SCHED_OTHER, &param);
+    if (err != 0) {
+        std::printf("[ WARN] Can not reset scheduling policy: %s\n", std::strerror(err));
+        ok = false;
+    }
+    return ok;
+}
+
+void DeadlineMonitor::reset() {
+    ticks_ = 0;
+    missed_ = 0;
+    worst_cycle_ = 0.0;
+}
+
+bool DeadlineMonitor::tick(bool met, double cycle_time) {
+    ticks_++;
+    if (cycle_time > worst_cycle_) {
+        worst_cycle_ = cycle_time;
+    }
+    if (!met) {
+        missed_++;
+    }
+    return !met;
+}
@@ -0,0 +1,46 @@
+#include "offboard/search_pattern.h"
+
+#include<algorithm>
+#include<cmath>
+
+SearchPattern::SearchPattern(double fx, double fy, double width, double height, double overlap) : fx_(fx),
+                                                                                              fy_(fy),
+                                                                                              width_(width),
+                                                                                              height_(height),
+                                                                                              overlap_(std::min(std::max(overlap, 0.0), 0.9)) {
+}
+
+/* the smaller footprint side is used, so the passes overlap for any yaw of the vehicle */
+double SearchPattern::spacing(double altitude) const {
+    return std::min(footprintWidth(altitude), footprintHeight(altitude)) * (1.0 - overlap_);
+}
+
+double SearchPattern::altitudeFor(double radius, int max_rings, double min_altitude, double max_altitude) const {
+    const double spacing_per_meter = spacing(1.0);
+    double altitude = min_altitude;
+    if (spacing_per_meter > 0.0 && max_rings > 0) {
+        altitude = std::max(altitude, radius / (max_rings * spacing_per_meter));
+    }
+    return std::min(altitude, std::max(max_altitude, min_altitude));
+}
+
+void SearchPattern::expandingSquare(const Eigen::Vector3d &center, double radius, std::vector<Eigen::Vector3d> &waypoints) const {
+    static const double dx[4] = {1.0, 0.0, -1.0, 0.0}; // east, north, west, south
+    static const double dy[4] = {0.0, 1.0, 0.0, -1.0};
+    waypoints.clear();
+    const double d = spacing(center.z());
+    if (d <= 0.0) {
+        return;
+    }
+    Eigen::Vector3d point = center;
+    for (int leg = 0; leg < MAX_LEGS; leg++) {
+        const int steps = leg / 2 + 1;
+        point.x() += dx[leg % 4] * steps * d;
+        point.y() += dy[leg % 4] * steps * d;
+        waypoints.push_back(point);
+        // after the 4th leg of a ring the square spans +-(ring) spacings around the center
+        if (leg % 4 == 3 && (leg / 4 + 1) * d >= radius) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,469 @@
+#include "offboard/spatial_map.h"
+
+#include<algorithm>
+#include<cmath>
+#include<cstdio>
+#include<fstream>
+#include<limits>
+#include<queue>
+#include<sstream>
+#include<unordered_map>
+
+namespace
+{
+
+const int64_t KEY_OFFSET = 1 << 20; // voxel indexes are stored as 21 bit unsigned values
+
+/* ray casting point in polygon test */
+bool insidePolygon(const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> &polygon, const Eigen::Vector2d &p) {
+    bool inside = false;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const Eigen::Vector2d &a = polygon[i];
+        const Eigen::Vector2d &b = polygon[j];
+        if (((a.y() > p.y()) != (b.y() > p.y())) && (p.x() < (b.x() - a.x()) * (p.y() - a.y()) / (b.y() - a.y()) + a.x())) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+double cross2d(const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+    return a.x() * b.y() - a.y() * b.x();
+}
+
+bool segmentsIntersect(const Eigen::Vector2d &p1, const Eigen::Vector2d &p2, const Eigen::Vector2d &q1, const Eigen::Vector2d &q2) {
+    double d1 = cross2d(q2 - q1, p1 - q1);
+    double d2 = cross2d(q2 - q1, p2 - q1);
+    double d3 = cross2d(p2 - p1, q1 - p1);
+    double d4 = cross2d(p2 - p1, q2 - p1);
+    return (((d1 > 0) != (d2 > 0)) || d1 == 0 || d2 == 0) && (((d3 > 0) != (d4 > 0)) || d3 == 0 || d4 == 0) &&
+           !(d1 == 0 && d2 == 0 && d3 == 0 && d4 == 0 &&
+             (std::max(p1.x(), p2.x()) < std::min(q1.x(), q2.x()) || std::max(q1.x(), q2.x()) < std::min(p1.x(), p2.x()) ||
+              std::max(p1.y(), p2.y()) < std::min(q1.y(), q2.y()) || std::max(q1.y(), q2.y()) < std::min(p1.y(), p2.y())));
+}
+
+double pointSegmentDistance(const Eigen::Vector2d &p, const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+    Eigen::Vector2d ab = b - a;
+    double len_sq = ab.squaredNorm();
+    double t = (len_sq > 0.0) ? std::min(1.0, std::max(0.0, (p - a).dot(ab) / len_sq)) : 0.0;
+    return (a + t * ab - p).norm();
+}
+
+double segmentDistance(const Eigen::Vector2d &p1, const Eigen::Vector2d &p2, const Eigen::Vector2d &q1, const Eigen::Vector2d &q2) {
+    if (segmentsIntersect(p1, p2, q1, q2)) {
+        return 0.0;
+    }
+    return std::min(std::min(pointSegmentDistance(p1, q1, q2), pointSegmentDistance(p2, q1, q2)),
+                    std::min(pointSegmentDistance(q1, p1, p2), pointSegmentDistance(q2, p1, p2)));
+}
+
+} // namespace
+
+SpatialMap::SpatialMap() : voxel_size_(0.5),
+                           inflation_(0.0) {
+}
+
+/* load map file
+   input: path of the map file and safety margin (m) added around obstacles and keep-out zones */
+bool SpatialMap::load(const std::string &file, double inflation) {
+    std::ifstream in(file.c_str());
+    if (!in.is_open()) {
+        std::printf("[ WARN] Can not open map file %s\n", file.c_str());
+        return false;
+    }
+    occupied_.clear();
+    fences_.clear();
+    inflation_ = std::max(0.0, inflation);
+    min_altitude_ = inflation_;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        std::string type;
+        if (!(ss >> type)) {
+            continue;
+        }
+        if (type == "voxel_size") {
+            if (!(ss >> voxel_size_) || voxel_size_ <= 0.0) {
+                std::printf("[ WARN] Map %s:%d: invalid voxel_size\n", file.c_str(), line_number);
+                return false;
+            }
+        }
+        else if (type == "box") {
+            Eigen::Vector3d lo, hi;
+            if (!(ss >> lo.x() >> lo.y() >> lo.z() >> hi.x() >> hi.y() >> hi.z())) {
+                std::printf("[ WARN] Map %s:%d: box needs xmin ymin zmin xmax ymax zmax\n", file.c_str(), line_number);
+                return false;
+            }
+            Eigen::Vector3i i_lo = indexOf(lo.cwiseMin(hi) - Eigen::Vector3d::Constant(inflation_));
+            Eigen::Vector3i i_hi = indexOf(lo.cwiseMax(hi) + Eigen::Vector3d::Constant(inflation_));
+            for (int x = i_lo.x(); x <= i_hi.x(); x++) {
+                for (int y = i_lo.y(); y <= i_hi.y(); y++) {
+                    for (int z = i_lo.z(); z <= i_hi.z(); z++) {
+                        occupied_.insert(keyOf(x, y, z));
+                    }
+                }
+            }
+        }
+        else if (type == "voxel") {
+            Eigen::Vector3d p;
+            if (!(ss >> p.x() >> p.y() >> p.z())) {
+                std::printf("[ WARN] Map %s:%d: voxel needs x y z\n", file.c_str(), line_number);
+                return false;
+            }
+            addOccupied(p);
+        }
+        else if (type == "min_altitude") {
+            if (!(ss >> min_altitude_)) {
+                std::printf("[ WARN] Map %s:%d: min_altitude needs z\n", file.c_str(), line_number);
+                return false;
+            }
+        }
+        else if (type == "keep_out" || type == "keep_in") {
+            Geofence fence;
+            fence.keep_in = (type == "keep_in");
+            double x, y;
+            if (!(ss >> fence.z_min >> fence.z_max)) {
+                std::printf("[ WARN] Map %s:%d: %s needs zmin zmax and a polygon\n", file.c_str(), line_number, type.c_str());
+                return false;
+            }
+            while (ss >> x >> y) {
+                fence.polygon.push_back(Eigen::Vector2d(x, y));
+            }
+            if (fence.polygon.size() < 3) {
+                std::printf("[ WARN] Map %s:%d: polygon needs at least 3 vertices\n", file.c_str(), line_number);
+                return false;
+            }
+            fences_.push_back(fence);
+        }
+        else {
+            std::printf("[ WARN] Map %s:%d: unknown entry '%s'\n", file.c_str(), line_number, type.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpatialMap::empty() const {
+    return occupied_.empty() && fences_.empty();
+}
+
+int64_t SpatialMap::keyOf(int ix, int iy, int iz) const {
+    return ((ix + KEY_OFFSET) << 42) | ((iy + KEY_OFFSET) << 21) | (iz + KEY_OFFSET);
+}
+
+Eigen::Vector3i SpatialMap::indexOf(const Eigen::Vector3d &point) const {
+    return Eigen::Vector3i(static_cast<int>(std::floor(point.x() / voxel_size_)),
+                           static_cast<int>(std::floor(point.y() / voxel_size_)),
+                           static_cast<int>(std::floor(point.z() / voxel_size_)));
+}
+
+Eigen::Vector3d SpatialMap::centerOf(const Eigen::Vector3i &index) const {
+    return (index.cast<double>() + Eigen::Vector3d::Constant(0.5)) * voxel_size_;
+}
+
+bool SpatialMap::voxelOccupied(const Eigen::Vector3i &index) const {
+    return occupied_.count(keyOf(index.x(), index.y(), index.z())) > 0;
+}
+
+/* mark the voxel of a point and every voxel within the inflation radius */
+void SpatialMap::addOccupied(const Eigen::Vector3d &point) {
+    Eigen::Vector3i center = indexOf(point);
+    int r = static_cast<int>(std::ceil(inflation_ / voxel_size_));
+    for (int x = -r; x <= r; x++) {
+        for (int y = -r; y <= r; y++) {
+            for (int z = -r; z <= r; z++) {
+                if (std::sqrt(double(x * x + y * y + z * z)) * voxel_size_ <= inflation_ + 1e-9) {
+                    occupied_.insert(keyOf(center.x() + x, center.y() + y, center.z() + z));
+                }
+            }
+        }
+    }
+}
+
+/* check a segment against one geofence prism */
+bool SpatialMap::fenceBlocks(const Geofence &fence, const Eigen::Vector3d &start, const Eigen::Vector3d &end) const {
+    const Eigen::Vector2d s2 = start.head<2>();
+    const Eigen::Vector2d e2 = end.head<2>();
+    const size_t n = fence.polygon.size();
+
+    if (fence.keep_in) {
+        if (start.z() < fence.z_min || start.z() > fence.z_max || end.z() < fence.z_min || end.z() > fence.z_max) {
+            return true;
+        }
+        if (!insidePolygon(fence.polygon, s2) || !insidePolygon(fence.polygon, e2)) {
+            return true;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (segmentDistance(s2, e2, fence.polygon[i], fence.polygon[(i + 1) % n]) < inflation_) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // part of the segment inside the (inflated) altitude band
+    double z_lo = fence.z_min - inflation_;
+    double z_hi = fence.z_max + inflation_;
+    double t0 = 0.0, t1 = 1.0;
+    double dz = end.z() - start.z();
+    if (std::abs(dz) < 1e-9) {
+        if (start.z() < z_lo || start.z() > z_hi) {
+            return false;
+        }
+    }
+    else {
+        double ta = (z_lo - start.z()) / dz;
+        double tb = (z_hi - start.z()) / dz;
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    const Eigen::Vector2d a = s2 + (e2 - s2) * t0;
+    const Eigen::Vector2d b = s2 + (e2 - s2) * t1;
+    if (insidePolygon(fence.polygon, a) || insidePolygon(fence.polygon, b)) {
+        return true;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (segmentDistance(a, b, fence.polygon[i], fence.polygon[(i + 1) % n]) <= inflation_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* walk every voxel crossed by the segment (Amanatides-Woo traversal) */
+bool SpatialMap::voxelsBlock(const Eigen::Vector3d &start, const Eigen::Vector3d &end) const {
+    if (occupied_.empty()) {
+        return false;
+    }
+    Eigen::Vector3i index = indexOf(start);
+    const Eigen::Vector3i last = indexOf(end);
+    const Eigen::Vector3d dir = end - start;
+
+    Eigen::Vector3i step;
+    Eigen::Vector3d t_max, t_delta;
+    for (int k = 0; k < 3; k++) {
+        if (dir[k] > 0.0) {
+            step[k] = 1;
+            t_max[k] = ((index[k] + 1) * voxel_size_ - start[k]) / dir[k];
+            t_delta[k] = voxel_size_ / dir[k];
+        }
+        else if (dir[k] < 0.0) {
+            step[k] = -1;
+            t_max[k] = (index[k] * voxel_size_ - start[k]) / dir[k];
+            t_delta[k] = -voxel_size_ / dir[k];
+        }
+        else {
+            step[k] = 0;
+            t_max[k] = std::numeric_limits<double>::infinity();
+            t_delta[k] = std::numeric_limits<double>::infinity();
+        }
+    }
+
+    const int max_steps = (last - index).cwiseAbs().sum() + 1;
+    for (int i = 0; i <= max_steps; i++) {
+        if (voxelOccupied(index)) {
+            return true;
+        }
+        if (index == last) {
+            break;
+        }
+        int k;
+        t_max.minCoeff(&k);
+        index[k] += step[k];
+        t_max[k] += t_delta[k];
+    }
+    return false;
+}
+
+/* diagonal move touching an occupied voxel: every voxel reached by a subset of the move must be free */
+bool SpatialMap::cutsCorner(const Eigen::Vector3i &index, const Eigen::Vector3i &move) const {
+    for (int mask = 1; mask < 7; mask++) {
+        Eigen::Vector3i partial(index);
+        for (int k = 0; k < 3; k++) {
+            if (mask & (1 << k)) {
+                partial[k] += move[k];
+            }
+        }
+        if (partial != index && partial != index + move && voxelOccupied(partial)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* first voxel layer whose center is at or above min_altitude_, or the layer of z when it is lower:
+   a leg from or to a point near the ground may come down to it, never further */
+int SpatialMap::floorIndex(double z) const {
+    const int floor_z = static_cast<int>(std::ceil(min_altitude_ / voxel_size_ - 0.5));
+    return std::min(floor_z, static_cast<int>(std::floor(z / voxel_size_)));
+}
+
+/* closest voxel center that is free, searched in a cube reaching one voxel past the safety margin
+   input: point (usually blocked), output: free position */
+bool SpatialMap::nearestFree(const Eigen::Vector3d &point, Eigen::Vector3d &free) const {
+    const Eigen::Vector3i center = indexOf(point);
+    const int r = static_cast<int>(std::ceil(inflation_ / voxel_size_)) + 1;
+    const int floor_z = floorIndex(point.z());
+    double best = std::numeric_limits<double>::max();
+    for (int x = -r; x <= r; x++) {
+        for (int y = -r; y <= r; y++) {
+            for (int z = -r; z <= r; z++) {
+                const Eigen::Vector3i index = center + Eigen::Vector3i(x, y, z);
+                if (index.z() < floor_z) {
+                    continue;
+                }
+                const Eigen::Vector3d candidate = centerOf(index);
+                const double d2 = (candidate - point).squaredNorm();
+                if (d2 < best && !voxelOccupied(index) && pointFree(candidate)) {
+                    best = d2;
+                    free = candidate;
+                }
+            }
+        }
+    }
+    return best < std::numeric_limits<double>::max();
+}
+
+bool SpatialMap::pointFree(const Eigen::Vector3d &point) const {
+    return segmentFree(point, point);
+}
+
+bool SpatialMap::segmentFree(const Eigen::Vector3d &start, const Eigen::Vector3d &end) const {
+    for (const Geofence &fence : fences_) {
+        if (fenceBlocks(fence, start, end)) {
+            return false;
+        }
+    }
+    return !voxelsBlock(start, end);
+}
+
+/* plan a detour around blocked space
+   input: start and goal positions (ENU), output: waypoints after start, last one is goal */
+bool SpatialMap::planDetour(const Eigen::Vector3d &start, const Eigen::Vector3d &goal, std::vector<Eigen::Vector3d> &waypoints) const {
+    waypoints.clear();
+    if (!pointFree(goal)) {
+        return false;
+    }
+    // a start inside the safety margin (blown or drifted into it) has no free neighbour to expand,
+    // the search starts from the closest free voxel and the path first leaves the margin to it
+    Eigen::Vector3d from = start;
+    if (!pointFree(start)) {
+        if (!nearestFree(start, from)) {
+            return false;
+        }
+        waypoints.push_back(from);
+    }
+    const Eigen::Vector3i start_index = indexOf(from);
+    const Eigen::Vector3i goal_index = indexOf(goal);
+    // the search box does not reach below the ground: detours also become mission items (relative altitude)
+    Eigen::Vector3i lo = indexOf(from.cwiseMin(goal) - Eigen::Vector3d::Constant(search_margin_));
+    const Eigen::Vector3i hi = indexOf(from.cwiseMax(goal) + Eigen::Vector3d::Constant(search_margin_));
+    lo.z() = std::max(lo.z(), floorIndex(std::min(from.z(), goal.z())));
+
+    struct Visit
+    {
+        double g;
+        int64_t parent;
+        Eigen::Vector3i index;
+        bool closed;
+    };
+    typedef std::pair<double, int64_t> QueueItem;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> open;
+    std::unordered_map<int64_t, Visit> visits;
+
+    const int64_t start_key = keyOf(start_index.x(), start_index.y(), start_index.z());
+    const int64_t goal_key = keyOf(goal_index.x(), goal_index.y(), goal_index.z());
+    visits[start_key] = Visit{0.0, -1, start_index, false};
+    open.push(QueueItem((goal_index - start_index).cast<double>().norm(), start_key));
+
+    bool found = false;
+    int expansions = 0;
+    while (!open.empty() && expansions < max_expansions_) {
+        int64_t key = open.top().second;
+        open.pop();
+        Visit &current = visits[key];
+        if (current.closed) {
+            continue;
+        }
+        current.closed = true;
+        expansions++;
+        if (key == goal_key) {
+            found = true;
+            break;
+        }
+        const Eigen::Vector3i index = current.index;
+        const double g = current.g;
+        const Eigen::Vector3d center = centerOf(index);
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    if (dx == 0 && dy == 0 && dz == 0) {
+                        continue;
+                    }
+                    Eigen::Vector3i next = index + Eigen::Vector3i(dx, dy, dz);
+                    if ((next.array() < lo.array()).any() || (next.array() > hi.array()).any() || voxelOccupied(next)) {
+                        continue;
+                    }
+                    if (cutsCorner(index, Eigen::Vector3i(dx, dy, dz))) {
+                        continue;
+                    }
+                    int64_t next_key = keyOf(next.x(), next.y(), next.z());
+                    double next_g = g + std::sqrt(double(dx * dx + dy * dy + dz * dz));
+                    auto it = visits.find(next_key);
+                    if (it != visits.end() && (it->second.closed || it->second.g <= next_g)) {
+                        continue;
+                    }
+                    bool fenced = false;
+                    for (const Geofence &fence : fences_) {
+                        if (fenceBlocks(fence, center, centerOf(next))) {
+                            fenced = true;
+                            break;
+                        }
+                    }
+                    if (fenced) {
+                        continue;
+                    }
+                    visits[next_key] = Visit{next_g, key, next, false};
+                    open.push(QueueItem(next_g + (goal_index - next).cast<double>().norm(), next_key));
+                }
+            }
+        }
+    }
+    if (!found) {
+        return false;
+    }
+
+    // voxel path from start to goal, with the exact start and goal positions at the ends
+    std::vector<Eigen::Vector3d> path;
+    for (int64_t key = goal_key; key != -1; key = visits[key].parent) {
+        path.push_back(centerOf(visits[key].index));
+    }
+    std::reverse(path.begin(), path.end());
+    if (path.size() == 1) {
+        path.push_back(goal); // start and goal in the same voxel
+    }
+    path.front() = from;
+    path.back() = goal;
+
+    // keep only the waypoints needed for line of sight between them
+    size_t anchor = 0;
+    while (anchor + 1 < path.size()) {
+        size_t next = anchor + 1;
+        for (size_t j = path.size() - 1; j > anchor + 1; j--) {
+            if (segmentFree(path[anchor], path[j])) {
+                next = j;
+                break;
+            }
+        }
+        waypoints.push_back(path[next]);
+        anchor = next;
+    }
+    return true;
+}
@@ -0,0 +1,164 @@
+#include "offboard/topic_watchdog.h"
+
+#include<cstdio>
+
+TopicWatchdog::TopicWatchdog(const ros::NodeHandle &nh, const ros::NodeHandle &nh_private) : nh_(nh),
+                                                                                           nh_private_(nh_private),
+                                                                                           running_(false),
+                                                                                           active_(false),
+                                                                                           tripped_(false) {
+    nh_.setCallbackQueue(&callback_queue_);
+    nh_private_.setCallbackQueue(&callback_queue_);
+
+    double rate;
+    nh_private_.param<bool>("watchdog_enable", enable_, true);
+    nh_private_.param<double>("watchdog_rate", rate, 100.0);
+    nh_private_.param<std::string>("failsafe_mode", failsafe_mode_, "AUTO.LOITER");
+    odom_.name = "mavros/local_position/odom";
+    nh_private_.param<double>("odom_deadline", odom_.deadline, 0.3);
+    nh_private_.param<double>("odom_min_rate", odom_.min_rate, 10.0);
+    gps_.name = "mavros/global_position/global";
+    nh_private_.param<double>("gps_deadline", gps_.deadline, 1.0);
+    nh_private_.param<double>("gps_min_rate", gps_.min_rate, 2.0);
+    period_ = (rate > 0.0) ? 1.0 / rate : 0.01;
+
+    if (enable_) {
+        odom_sub_ = nh_.subscribe(odom_.name, 10, &TopicWatchdog::odomCallback, this);
+        gps_sub_ = nh_.subscribe(gps_.name, 10, &TopicWatchdog::gpsCallback, this);
+        diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+        set_mode_client_ = nh_.serviceClient<mavros_msgs::SetMode>("mavros/set_mode");
+    }
+}
+
+TopicWatchdog::~TopicWatchdog() {
+    stop();
+}
+
+void TopicWatchdog::start() {
+    if (!enable_ || running_) {
+        return;
+    }
+    started_ = last_diagnostics_ = Clock::now();
+    running_ = true;
+    thread_ = std::thread(&TopicWatchdog::run, this);
+}
+
+void TopicWatchdog::stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void TopicWatchdog::setActive(bool active) {
+    active_ = active;
+}
+
+/* a request in progress when the watchdog trips completes first, the failsafe mode is sent after it;
+   once tripped the mission thread can not switch the FCU out of the failsafe mode */
+bool TopicWatchdog::setMode(ros::ServiceClient &client, mavros_msgs::SetMode &mode) {
+    std::lock_guard<std::mutex> lock(mode_mutex_);
+    if (tripped_) {
+        return false;
+    }
+    return client.call(mode);
+}
+
+/* watchdog thread: callAvailable returns as soon as a message arrives or after period_,
+   so receipts are stamped without delay and deadlines are checked at least every period_ */
+void TopicWatchdog::run() {
+    while (running_ && ros::ok()) {
+        callback_queue_.callAvailable(ros::WallDuration(period_));
+        check(Clock::now());
+    }
+}
+
+void TopicWatchdog::check(Clock::time_point now) {
+    bool odom_stale = updateStatus(odom_, now);
+    bool gps_stale = updateStatus(gps_, now);
+    if (active_ && !tripped_ && (odom_stale || gps_stale)) {
+        trip(odom_stale ? odom_ : gps_, now);
+    }
+    if (std::chrono::duration<double>(now - last_diagnostics_).count() >= 1.0) {
+        publishDiagnostics(now);
+    }
+}
+
+/* a topic is stale when its last message is older than the deadline
+   or when its filtered rate dropped below min_rate; deadline <= 0 disables the topic */
+bool TopicWatchdog::updateStatus(TopicStatus &topic, Clock::time_point now) {
+    if (topic.deadline <= 0.0) {
+        topic.stale = false;
+        return false;
+    }
+    double age = std::chrono::duration<double>(now - (topic.received ? topic.last : started_)).count();
+    bool slow = topic.min_rate > 0.0 && topic.interval > 0.0 && (1.0 / topic.interval) < topic.min_rate;
+    topic.stale = age > topic.deadline || slow;
+    return topic.stale;
+}
+
+void TopicWatchdog::received(TopicStatus &topic) {
+    Clock::time_point now = Clock::now();
+    if (topic.received) {
+        double dt = std::chrono::duration<double>(now - topic.last).count();
+        topic.interval = (topic.interval > 0.0) ? 0.8 * topic.interval + 0.2 * dt : dt;
+    }
+    topic.last = now;
+    topic.received = true;
+}
+
+void TopicWatchdog::trip(const TopicStatus &topic, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mode_mutex_);
+    tripped_ = true;
+    double age = std::chrono::duration<double>(now - (topic.received ? topic.last : started_)).count();
+    std::printf("\n[ WARN] Watchdog: %s stale (age %.3f s), switching to %s\n", topic.name.c_str(), age, failsafe_mode_.c_str());
+    mavros_msgs::SetMode failsafe_mode;
+    failsafe_mode.request.custom_mode = failsafe_mode_;
+    if (!set_mode_client_.call(failsafe_mode) || !failsafe_mode.response.mode_sent) {
+        std::printf("[ WARN] Watchdog: failed to set %s\n", failsafe_mode_.c_str());
+    }
+    publishDiagnostics(now);
+}
+
+void TopicWatchdog::publishDiagnostics(Clock::time_point now) {
+    last_diagnostics_ = now;
+    diagnostic_msgs::DiagnosticArray array;
+    array.header.stamp = ros::Time::now();
+    for (const TopicStatus *topic : {&odom_, &gps_}) {
+        if (topic->deadline <= 0.0) {
+            continue;
+        }
+        diagnostic_msgs::DiagnosticStatus status;
+        status.name = "offboard watchdog: " + topic->name;
+        status.hardware_id = nh_.getNamespace();
+        if (!topic->stale) {
+            status.level = diagnostic_msgs::DiagnosticStatus::OK;
+            status.message = "ok";
+        }
+        else {
+            status.level = tripped_ ? diagnostic_msgs::DiagnosticStatus::ERROR : diagnostic_msgs::DiagnosticStatus::WARN;
+            status.message = tripped_ ? "stale, failsafe " + failsafe_mode_ : "stale";
+        }
+        double age = std::chrono::duration<double>(now - (topic->received ? topic->last : started_)).count();
+        diagnostic_msgs::KeyValue value;
+        value.key = "age";
+        value.value = std::to_string(age);
+        status.values.push_back(value);
+        value.key = "rate";
+        value.value = std::to_string(topic->interval > 0.0 ? 1.0 / topic->interval : 0.0);
+        status.values.push_back(value);
+        value.key = "deadline";
+        value.value = std::to_string(topic->deadline);
+        status.values.push_back(value);
+        array.status.push_back(status);
+    }
+    diagnostics_pub_.publish(array);
+}
+
+void TopicWatchdog::odomCallback(const nav_msgs::Odometry::ConstPtr &msg) {
+    received(odom_);
+}
+
+void TopicWatchdog::gpsCallback(const sensor_msgs::NavSatFix::ConstPtr &msg) {
+    received(gps_);
+}
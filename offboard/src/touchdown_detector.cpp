@@ -0,0 +1,80 @@
+#include "offboard/touchdown_detector.h"
+
+#include<algorithm>
+#include<cmath>
+
+/* descent speed at a height above ground */
+double DescentProfile::velocity(double height) const {
+    if (height <= slow_height) {
+        return slow_velocity;
+    }
+    if (blend_height <= 0.0 || height >= slow_height + blend_height) {
+        return fast_velocity;
+    }
+    double k = (height - slow_height) / blend_height;
+    return slow_velocity + k * (fast_velocity - slow_velocity);
+}
+
+const int TouchdownDetector::CAPACITY;
+
+TouchdownDetector::TouchdownDetector() {
+}
+
+void TouchdownDetector::configure(double window, double max_speed, double max_spread, double max_height, double max_thrust) {
+    window_ = window;
+    max_speed_ = max_speed;
+    max_spread_ = max_spread;
+    max_height_ = max_height;
+    max_thrust_ = max_thrust;
+    reset();
+}
+
+void TouchdownDetector::reset() {
+    head_ = 0;
+    count_ = 0;
+    landed_ = false;
+}
+
+bool TouchdownDetector::addSample(double time, double height, double z, double vz, double thrust) {
+    samples_[head_] = Sample{time, height, z, vz, thrust};
+    head_ = (head_ + 1) % CAPACITY;
+    count_ = std::min(count_ + 1, CAPACITY);
+    if (!landed_) {
+        landed_ = evaluate();
+    }
+    return landed_;
+}
+
+/* walk back from the newest sample until the window is covered */
+bool TouchdownDetector::evaluate() const {
+    if (count_ < 3) {
+        return false;
+    }
+    const Sample &newest = samples_[(head_ + CAPACITY - 1) % CAPACITY];
+    double z_min = newest.z, z_max = newest.z;
+    double thrust_sum = 0.0;
+    int thrust_count = 0;
+    int used = 0;
+    bool covered = false;
+    for (int k = 1; k <= count_; k++) {
+        const Sample &s = samples_[(head_ + CAPACITY - k) % CAPACITY];
+        if (s.height > max_height_ || std::abs(s.vz) > max_speed_) {
+            return false;
+        }
+        z_min = std::min(z_min, s.z);
+        z_max = std::max(z_max, s.z);
+        if (s.thrust >= 0.0) {
+            thrust_sum += s.thrust;
+            thrust_count++;
+        }
+        used++;
+        if (newest.time - s.time >= window_) {
+            covered = true;
+            break;
+        }
+    }
+    if (!covered || used < 3 || (z_max - z_min) > max_spread_) {
+        return false;
+    }
+    return thrust_count == 0 || (thrust_sum / thrust_count) <= max_thrust_;
+}
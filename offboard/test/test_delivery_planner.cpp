@@ -0,0 +1,67 @@
+#include "offboard/delivery_planner.h"
+
+#include<gtest/gtest.h>
+
+namespace
+{
+
+DeliveryStop stopAt(int id, double x, double y) {
+    DeliveryStop stop;
+    stop.id = id;
+    stop.position << x, y, 5.0;
+    return stop;
+}
+
+} // namespace
+
+// a stop next to the vehicle goes first when nothing is fixed
+TEST(DeliveryPlanner, InsertsAtTheHead) {
+    DeliveryPlanner planner(50.0, 8);
+    DeliveryRoute route;
+    route.push_back(stopAt(0, 20.0, 0.0));
+    route.push_back(stopAt(1, 40.0, 0.0));
+    route.push_back(stopAt(2, 60.0, 0.0));
+    planner.rebuild(route);
+    EXPECT_EQ(planner.insert(Eigen::Vector3d(0.0, 0.0, 5.0), route, stopAt(7, 1.0, 0.0)), 0);
+    EXPECT_EQ(route.front().id, 7);
+    EXPECT_EQ(route.back().id, 2);
+}
+
+// the stop being delivered stays first, whatever insertion and 2-opt would prefer
+TEST(DeliveryPlanner, InsertKeepsFixedStop) {
+    DeliveryPlanner planner(50.0, 8);
+    DeliveryRoute route;
+    route.push_back(stopAt(0, 20.0, 0.0));
+    route.push_back(stopAt(1, 1.0, 0.0));
+    route.push_back(stopAt(2, 40.0, 0.0));
+    route.push_back(stopAt(3, 60.0, 0.0));
+    planner.rebuild(route);
+    const int index = planner.insert(Eigen::Vector3d(0.0, 0.0, 5.0), route, stopAt(7, 0.5, 0.0), 1);
+    ASSERT_EQ(route.size(), 5u);
+    EXPECT_GE(index, 1);
+    EXPECT_EQ(route[index].id, 7);
+    EXPECT_EQ(route.front().id, 0);
+    EXPECT_DOUBLE_EQ(route.front().position.x(), 20.0);
+    EXPECT_EQ(route.back().id, 3);
+}
+
+TEST(DeliveryPlanner, CancelKeepsFixedStop) {
+    DeliveryPlanner planner;
+    DeliveryRoute route;
+    route.push_back(stopAt(0, 20.0, 0.0));
+    route.push_back(stopAt(1, 40.0, 0.0));
+    route.push_back(stopAt(2, 60.0, 0.0));
+    planner.rebuild(route);
+    EXPECT_FALSE(planner.cancel(route, 0, 1));
+    EXPECT_FALSE(planner.cancel(route, 2, 1));
+    ASSERT_EQ(route.size(), 3u);
+    EXPECT_TRUE(planner.cancel(route, 1, 1));
+    ASSERT_EQ(route.size(), 2u);
+    EXPECT_EQ(route.front().id, 0);
+    EXPECT_TRUE(planner.cancel(route, 0));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,66 @@
+#include "offboard/spatial_map.h"
+#include "offboard/detour_planner.h"
+
+#include<gtest/gtest.h>
+
+#include<chrono>
+#include<fstream>
+#include<string>
+#include<thread>
+
+namespace
+{
+
+std::string writeMap(const std::string &name, const std::string &content) {
+    const std::string file = testing::TempDir() + name;
+    std::ofstream map(file.c_str());
+    map << content;
+    return file;
+}
+
+} // namespace
+
+// a wall standing on the ground is passed around its side, not under it
+TEST(SpatialMap, DetourStaysAboveGround) {
+    SpatialMap map;
+    ASSERT_TRUE(map.load(writeMap("offboard_wall_map.txt", "voxel_size 0.5\nbox 4 -10 0 6 10 20\n"), 0.5));
+    std::vector<Eigen::Vector3d> waypoints;
+    ASSERT_TRUE(map.planDetour(Eigen::Vector3d(0.0, 0.0, 2.0), Eigen::Vector3d(10.0, 0.0, 2.0), waypoints));
+    ASSERT_FALSE(waypoints.empty());
+    for (const Eigen::Vector3d &waypoint : waypoints) {
+        EXPECT_GE(waypoint.z(), 0.5);
+    }
+}
+
+// min_altitude of the map file raises the floor of the search
+TEST(SpatialMap, DetourKeepsMinAltitude) {
+    SpatialMap map;
+    ASSERT_TRUE(map.load(writeMap("offboard_floor_map.txt", "voxel_size 0.5\nmin_altitude 3.0\nbox 4 -10 0 6 10 20\n"), 0.5));
+    std::vector<Eigen::Vector3d> waypoints;
+    ASSERT_TRUE(map.planDetour(Eigen::Vector3d(0.0, 0.0, 5.0), Eigen::Vector3d(10.0, 0.0, 5.0), waypoints));
+    for (const Eigen::Vector3d &waypoint : waypoints) {
+        EXPECT_GE(waypoint.z(), 3.0);
+    }
+}
+
+// requests return at once, the search runs on the planner thread and only the newest request is answered
+TEST(DetourPlanner, PlansInBackground) {
+    SpatialMap map;
+    ASSERT_TRUE(map.load(writeMap("offboard_planner_map.txt", "voxel_size 0.5\nbox 4 -10 0 6 10 20\n"), 0.5));
+    DetourPlanner planner(map);
+    planner.start();
+    std::vector<Eigen::Vector3d> waypoints;
+    bool found = false;
+    double planning_ms = 0.0;
+    planner.request(Eigen::Vector3d(0.0, 0.0, 2.0), Eigen::Vector3d(5.0, 0.0, 2.0)); // goal inside the wall
+    planner.request(Eigen::Vector3d(0.0, 0.0, 2.0), Eigen::Vector3d(10.0, 0.0, 2.0)); // around the wall, tens of ms
+    EXPECT_FALSE(planner.result(waypoints, found, planning_ms));
+    for (int k = 0; k < 500 && !planner.result(waypoints, found, planning_ms); k++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    planner.stop();
+    ASSERT_TRUE(found);
+    ASSERT_FALSE(waypoints.empty());
+    EXPECT_TRUE(waypoints.back().isApprox(Eigen::Vector3d(10.0, 0.0, 2.0)));
+    EXPECT_FALSE(planner.result(waypoints, found, planning_ms));
+}
@@ -0,0 +1,250 @@
+#include "offboard/offboard.h"
+
+#include<gtest/gtest.h>
+
+#include<atomic>
+#include<chrono>
+#include<cstdlib>
+#include<fstream>
+#include<new>
+#include<string>
+#include<thread>
+
+namespace
+{
+
+thread_local bool counting = false; // count the allocations of the test thread only (log writer, planner and checkpoint threads allocate)
+std::atomic<long> allocations(0);
+
+const double VELOCITY = 0.7; // desired_velocity of offboard.launch (m/s)
+const double YAW_RATE = 0.05; // yaw_rate of offboard.launch (rad)
+const double TARGET_ERROR = 0.5; // reached distance of the simulated vehicle, which moves half way to each setpoint (m)
+const double DETOUR_ERROR = 0.5; // detour_error of offboard.launch (m)
+
+void *allocate(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return std::malloc(size ? size : 1);
+}
+
+#ifdef __cpp_aligned_new
+void *allocateAligned(size_t size, std::align_val_t alignment) {
+    if (counting) {
+        allocations++;
+    }
+    const size_t align = static_cast<size_t>(alignment);
+    return std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align);
+}
+#endif
+
+} // namespace
+
+// every replaceable allocation function is counted, the deallocation ones only free
+void *operator new(size_t size) {
+    void *p = allocate(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    void *p = allocate(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t size, std::align_val_t alignment) {
+    void *p = allocateAligned(size, alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    void *p = allocateAligned(size, alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+#endif
+
+/* the ENU flight loop with its containers reserved like reserveContainers(): odometry copy of odomCallback,
+   enuTick (leg validation, the first leg is blocked and flown through a detour of the planner thread, carrot,
+   yaw, step check), setpoint message, throttled log, every 10 ticks the ETA message and, at each reached
+   setpoint, the checkpoint posted to its writer. Publishing is done by roscpp and is not counted */
+TEST(ControlTick, NoHeapAllocation) {
+    const std::string map_file = testing::TempDir() + "offboard_tick_map.txt";
+    {
+        std::ofstream map(map_file.c_str());
+        map << "voxel_size 0.5\n";
+        map << "box 8 -1 0 9 1 10\n";
+        map << "keep_out 0 50 20 20 25 20 25 25 20 25\n";
+    }
+    SpatialMap spatial_map;
+    ASSERT_TRUE(spatial_map.load(map_file, 0.5));
+    LegGuard leg(spatial_map);
+    leg.configure(true, DETOUR_ERROR, 0, 1.0);
+    leg.reserve(256);
+    leg.start();
+
+    const int n = 3;
+    std::vector<int> ids;
+    std::vector<double> x, y, z;
+    for (int k = 0; k < n; k++) {
+        ids.push_back(k);
+        x.push_back(15.0 * (k + 1));
+        y.push_back(4.0 * k);
+        z.push_back(5.0);
+    }
+    const Eigen::Vector3d start(0.0, 0.0, 5.0);
+    ASSERT_FALSE(spatial_map.segmentFree(start, Eigen::Vector3d(x[0], y[0], z[0])));
+
+    DeliveryPlanner planner;
+    DeliveryRoute eta_route;
+    std::vector<double> eta;
+    offboard::DeliveryEtas etas_msg;
+    eta_route.reserve(64);
+    eta.reserve(64);
+    etas_msg.ids.reserve(64);
+    etas_msg.positions.reserve(64);
+    etas_msg.eta.reserve(64);
+
+    CheckpointWriter checkpoint_writer;
+    MissionCheckpoint checkpoint;
+    checkpoint.x_target.reserve(64);
+    checkpoint.y_target.reserve(64);
+    checkpoint.z_target.reserve(64);
+    checkpoint_writer.reserve(64);
+    checkpoint_writer.start(MissionCheckpointFile(testing::TempDir() + "offboard_tick_checkpoint.txt"));
+
+    nav_msgs::Odometry odom_msg;
+    odom_msg.header.frame_id = "odom";
+    odom_msg.child_frame_id = "base_link";
+    nav_msgs::Odometry current_odom;
+
+    Vector3Snapshot drift;
+    drift.store(Eigen::Vector3d(0.2, -0.1, 0.0));
+    geometry_msgs::PoseStamped target;
+    AsyncLogger::instance().start("", false);
+    AsyncLogger::instance().registerThread();
+
+    Eigen::Vector3d vehicle = start;
+    Eigen::Vector3d hold = start;
+    double yaw = 0.0;
+    int i = 0;
+    long ticks = 0;
+    leg.reset(start);
+    counting = true;
+    for (; i < n && ticks < 5000; ticks++) {
+        odom_msg.pose.pose.position.x = vehicle.x();
+        odom_msg.pose.pose.position.y = vehicle.y();
+        odom_msg.pose.pose.position.z = vehicle.z();
+        current_odom = odom_msg;
+        const Eigen::Vector3d current(current_odom.pose.pose.position.x, current_odom.pose.pose.position.y, current_odom.pose.pose.position.z);
+        const Eigen::Vector3d setpoint = Eigen::Vector3d(x[i], y[i], z[i]) + drift.load();
+
+        const EnuTick tick = enuTick(leg, current, yaw, setpoint, VELOCITY, YAW_RATE, hold);
+        fillTargetPose(target, tick.position, tf::createQuaternionMsgFromYaw(tick.yaw), ros::Time::now());
+        OFFBOARD_LOG_THROTTLE(1.0, "Distance to target: %.1f (m) \n", tick.distance);
+        if (ticks % 10 == 0) {
+            fillRoute(eta_route, ids, x, y, z, i, n);
+            planner.etas(current, eta_route, VELOCITY, 30.0, eta);
+            fillDeliveryEtas(etas_msg, eta_route, eta, ros::Time::now());
+        }
+        if (leg.clear() && (setpoint - current).norm() < TARGET_ERROR) {
+            i++;
+            checkpoint.next_target = i;
+            checkpoint.setTargets(x, y, z, n);
+            checkpoint_writer.post(checkpoint);
+        }
+
+        // simulated vehicle: half way to the published position, perfect yaw tracking
+        vehicle += 0.5 * (tick.position - vehicle);
+        yaw = tick.yaw;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1)); // the planner thread answers within a few ticks
+    }
+    counting = false;
+    checkpoint_writer.stop();
+    leg.stop();
+    AsyncLogger::instance().stop();
+
+    EXPECT_EQ(i, n) << "setpoints reached in " << ticks << " ticks";
+    EXPECT_EQ(allocations.load(), 0) << "heap allocations in " << ticks << " ticks";
+}
+
+int main(int argc, char **argv) {
+    ros::Time::init();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}